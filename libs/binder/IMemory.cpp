@@ -178,8 +178,9 @@ BpMemory::~BpMemory()
 sp<IMemoryHeap> BpMemory::getMemory(ssize_t* offset, size_t* size) const
 {
     if (mHeap == 0) {
+        const Parcel::InterfaceToken& token(IMemory::interfaceToken);
         Parcel data, reply;
-        data.writeInterfaceToken(IMemory::getInterfaceDescriptor());
+        data.writeInterfaceToken(token);
         if (remote()->transact(GET_MEMORY, data, &reply) == NO_ERROR) {
             sp<IBinder> heap = reply.readStrongBinder();
             ssize_t o = reply.readInt32();
@@ -290,8 +291,9 @@ void BpMemoryHeap::assertReallyMapped() const
         // calling transact() from multiple threads, but that's not a problem,
         // only mmap below must be in the critical section.
 
+        const Parcel::InterfaceToken& token(IMemoryHeap::interfaceToken);
         Parcel data, reply;
-        data.writeInterfaceToken(IMemoryHeap::getInterfaceDescriptor());
+        data.writeInterfaceToken(token);
         status_t err = remote()->transact(HEAP_ID, data, &reply);
         int parcel_fd = reply.readFileDescriptor();
         ssize_t size = reply.readInt32();
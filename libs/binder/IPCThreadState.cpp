@@ -96,7 +96,8 @@ static const char *kReturnStrings[] = {
     "BR_FINISHED",
     "BR_DEAD_BINDER",
     "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-    "BR_FAILED_REPLY"
+    "BR_FAILED_REPLY",
+    "BR_DEAD_TAGGED_REPLY"
 };
 
 static const char *kCommandStrings[] = {
@@ -205,6 +206,14 @@ static const void* printReturnCommand(TextOutput& out, const void* _cmd)
             out << ": death cookie " << (void*)c;
         } break;
 
+        case (int32_t) BR_DEAD_TAGGED_REPLY: {
+            // the cookie is the pointer transactAsync() tagged the call with
+            void* c;
+            memcpy(&c, cmd, sizeof(c));
+            cmd += sizeof(c) / sizeof(*cmd);
+            out << ": reply cookie " << c;
+        } break;
+
         default:
             // no details to show for: BR_OK, BR_DEAD_REPLY,
             // BR_TRANSACTION_COMPLETE, BR_FINISHED
@@ -296,8 +305,21 @@ static pthread_key_t gTLS = 0;
 static bool gShutdown = false;
 static bool gDisableBackgroundScheduling = false;
 
+#if defined(HAVE_TLS)
+// The calling thread's state, as also stored under gTLS.  self() is called
+// on every transaction and most Parcel reads and writes of the RPC header,
+// and this avoids the pthread_getspecific() call.  The key is still what
+// runs threadDestructor() when the thread exits.
+static __thread IPCThreadState* gSelf = NULL;
+#endif
+
 IPCThreadState* IPCThreadState::self()
 {
+#if defined(HAVE_TLS)
+    IPCThreadState* const cached = gSelf;
+    if (cached) return cached;
+#endif
+
     if (gHaveTLS) {
 restart:
         const pthread_key_t k = gTLS;
@@ -322,6 +344,11 @@ restart:
 
 IPCThreadState* IPCThreadState::selfOrNull()
 {
+#if defined(HAVE_TLS)
+    IPCThreadState* const cached = gSelf;
+    if (cached) return cached;
+#endif
+
     if (gHaveTLS) {
         const pthread_key_t k = gTLS;
         IPCThreadState* st = (IPCThreadState*)pthread_getspecific(k);
@@ -338,6 +365,9 @@ void IPCThreadState::shutdown()
         // XXX Need to wait for all thread pool threads to exit!
         IPCThreadState* st = (IPCThreadState*)pthread_getspecific(gTLS);
         if (st) {
+#if defined(HAVE_TLS)
+            gSelf = NULL;
+#endif
             delete st;
             pthread_setspecific(gTLS, NULL);
         }
@@ -428,38 +458,20 @@ void IPCThreadState::joinThreadPool(bool isMain)
     // scheduling group, so first we will make sure it is in the default/foreground
     // one to avoid performing an initial transaction in the background.
     androidSetThreadSchedulingGroup(mMyThreadId, ANDROID_TGROUP_DEFAULT);
+    mProcess->applyThreadPoolPolicy();
         
     status_t result;
     do {
         int32_t cmd;
         
-        // When we've cleared the incoming command queue, process any pending derefs
-        if (mIn.dataPosition() >= mIn.dataSize()) {
-            size_t numPending = mPendingWeakDerefs.size();
-            if (numPending > 0) {
-                for (size_t i = 0; i < numPending; i++) {
-                    RefBase::weakref_type* refs = mPendingWeakDerefs[i];
-                    refs->decWeak(mProcess.get());
-                }
-                mPendingWeakDerefs.clear();
-            }
-
-            numPending = mPendingStrongDerefs.size();
-            if (numPending > 0) {
-                for (size_t i = 0; i < numPending; i++) {
-                    BBinder* obj = mPendingStrongDerefs[i];
-                    obj->decStrong(mProcess.get());
-                }
-                mPendingStrongDerefs.clear();
-            }
-        }
+        processPendingDerefs();
 
         // now get the next command to be processed, waiting if necessary
         result = talkWithDriver();
         if (result >= NO_ERROR) {
             size_t IN = mIn.dataAvail();
             if (IN < sizeof(int32_t)) continue;
-            cmd = mIn.readInt32();
+            cmd = readCommand();
             IF_LOG_COMMANDS() {
                 alog << "Processing top-level Command: "
                     << getReturnString(cmd) << endl;
@@ -492,6 +504,55 @@ void IPCThreadState::joinThreadPool(bool isMain)
     talkWithDriver(false);
 }
 
+status_t IPCThreadState::setupPolling(int* fd)
+{
+    if (mProcess->mDriverFD <= 0) {
+        return -EBADF;
+    }
+
+    // A blocking read could wait for work another looper has already
+    // taken, stalling the event loop.
+    int nonBlock = 1;
+    if (ioctl(mProcess->mDriverFD, BINDER_SET_NON_BLOCK, &nonBlock) < 0) {
+        return INVALID_OPERATION;
+    }
+
+    mOut.writeInt32(BC_ENTER_LOOPER);
+    flushCommands();
+    *fd = mProcess->mDriverFD;
+    return NO_ERROR;
+}
+
+status_t IPCThreadState::handlePolledCommands()
+{
+    status_t result;
+
+    // Drain everything queued for us; the read comes back empty instead of
+    // blocking once there's nothing left.
+    do {
+        processPendingDerefs();
+
+        result = talkWithDriver();
+        if (result < NO_ERROR || mIn.dataAvail() < sizeof(int32_t)) break;
+
+        const int32_t cmd = readCommand();
+        IF_LOG_COMMANDS() {
+            alog << "Processing polled Command: "
+                << getReturnString(cmd) << endl;
+        }
+
+        result = executeCommand(cmd);
+    } while (result != -ECONNREFUSED && result != -EBADF);
+
+    // The loop won't come back until there's more input, so don't leave
+    // replies, frees or derefs sitting in mOut.
+    processPendingDerefs();
+    flushCommands();
+    androidSetThreadSchedulingGroup(mMyThreadId, ANDROID_TGROUP_DEFAULT);
+
+    return (result == -ECONNREFUSED || result == -EBADF) ? result : NO_ERROR;
+}
+
 void IPCThreadState::stopProcess(bool immediate)
 {
     //LOGI("**** STOPPING PROCESS");
@@ -520,6 +581,9 @@ status_t IPCThreadState::transact(int32_t handle,
     if (err == NO_ERROR) {
         LOG_ONEWAY(">>>> SEND from pid %d uid %d %s", getpid(), getuid(),
             (flags & TF_ONE_WAY) == 0 ? "READ REPLY" : "ONE WAY");
+        if ((flags & TF_ONE_WAY) != 0 && mOnewayBatchDepth > 0) {
+            return queueOneway(handle, code, data, flags);
+        }
         err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, NULL);
     }
     
@@ -564,6 +628,210 @@ status_t IPCThreadState::transact(int32_t handle,
     return err;
 }
 
+void IPCThreadState::beginOnewayBatch()
+{
+    mOnewayBatchDepth++;
+}
+
+status_t IPCThreadState::endOnewayBatch()
+{
+    LOG_ASSERT(mOnewayBatchDepth > 0, "endOnewayBatch() without beginOnewayBatch()");
+    if (mOnewayBatchDepth <= 0 || --mOnewayBatchDepth > 0) {
+        return NO_ERROR;
+    }
+
+    flushOnewayBatch();
+    const status_t err = mOnewayBatchError;
+    mOnewayBatchError = NO_ERROR;
+    return err;
+}
+
+status_t IPCThreadState::queueOneway(int32_t handle, uint32_t code,
+                                     const Parcel& data, uint32_t flags)
+{
+    // The driver only copies the data when mOut is written out, by which
+    // time the caller's parcel may be gone; keep our own until then.
+    Parcel* copy = new Parcel;
+    status_t err = copy->appendFrom(&data, 0, data.dataSize());
+    if (err == NO_ERROR) {
+        err = writeTransactionData(BC_TRANSACTION, flags, handle, code, *copy, NULL);
+    }
+    if (err != NO_ERROR) {
+        delete copy;
+        return (mLastError = err);
+    }
+
+    mOnewayBatch.push(copy);
+    mOnewayPending++;
+    if (mOnewayBatch.size() >= MAX_ONEWAY_BATCH) {
+        return flushOnewayBatch();
+    }
+    return NO_ERROR;
+}
+
+status_t IPCThreadState::flushOnewayBatch()
+{
+    status_t err = NO_ERROR;
+
+    // One write for the whole batch; the completions come back together.
+    while (mOnewayPending > 0) {
+        if ((err=talkWithDriver()) < NO_ERROR) break;
+        err = mIn.errorCheck();
+        if (err < NO_ERROR) break;
+        if (mIn.dataAvail() == 0) continue;
+
+        err = executeCommand(readCommand());
+        if (err != NO_ERROR) break;
+    }
+    return err;
+}
+
+void IPCThreadState::onewayCompleted(status_t err)
+{
+    if (mOnewayBatchError == NO_ERROR) {
+        mOnewayBatchError = err;
+    }
+    if (--mOnewayPending == 0) {
+        const size_t N = mOnewayBatch.size();
+        for (size_t i = 0; i < N; i++) {
+            delete mOnewayBatch[i];
+        }
+        mOnewayBatch.clear();
+    }
+}
+
+status_t IPCThreadState::transactAsync(int32_t handle,
+                                       uint32_t code, const Parcel& data,
+                                       const sp<AsyncReply>& reply, uint32_t flags)
+{
+#ifdef INLINE_TRANSACTION_DATA
+    // Inline replies live in mIn and can't be kept past the next read.
+    return INVALID_OPERATION;
+#else
+    if (reply == NULL || (flags & TF_ONE_WAY) != 0) return BAD_VALUE;
+
+    if ((mProcess->mDriverFeatures & BINDER_FEATURE_TAGGED_REPLY) == 0) {
+        return INVALID_OPERATION;
+    }
+
+    AsyncReply* call = reply.get();
+    if (findAsyncReply(call) >= 0) {
+        LOGE("transactAsync: reply %p is still outstanding", call);
+        return INVALID_OPERATION;
+    }
+
+    status_t err = data.errorCheck();
+    if (err == NO_ERROR) {
+        flags |= TF_ACCEPT_FDS | TF_TAGGED_REPLY;
+        err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, NULL, call);
+    }
+    if (err != NO_ERROR) {
+        return (mLastError = err);
+    }
+
+    call->mReply.freeData();
+    call->mStatus = NO_ERROR;
+    call->mDone = false;
+    call->incStrong(this);
+    mAsyncReplies.push(call);
+
+    // Only wait for BR_TRANSACTION_COMPLETE; the reply comes later.
+    err = waitForResponse(NULL, NULL);
+    if (err != NO_ERROR) {
+        // The transaction never got to the target, so there won't be a
+        // reply to deliver.
+        const ssize_t i = findAsyncReply(call);
+        if (i >= 0) {
+            mAsyncReplies.removeAt(i);
+            call->mStatus = err;
+            call->mReply.setError(err);
+            call->mDone = true;
+            call->decStrong(this);
+        }
+    }
+    return err;
+#endif
+}
+
+status_t IPCThreadState::waitForAsyncReplies(const sp<AsyncReply>& until)
+{
+    status_t err = NO_ERROR;
+
+    while (mAsyncReplies.size() > 0 && (until == NULL || !until->mDone)) {
+        if ((err=talkWithDriver()) < NO_ERROR) break;
+        err = mIn.errorCheck();
+        if (err < NO_ERROR) break;
+        if (mIn.dataAvail() == 0) continue;
+
+        const int32_t cmd = readCommand();
+
+        IF_LOG_COMMANDS() {
+            alog << "Processing waitForAsyncReplies Command: "
+                << getReturnString(cmd) << endl;
+        }
+
+        err = executeCommand(cmd);
+        if (err != NO_ERROR) break;
+    }
+
+    if (err == NO_ERROR && until != NULL && !until->mDone) {
+        // Nothing outstanding on this thread, so it was issued elsewhere.
+        err = INVALID_OPERATION;
+    }
+    return err;
+}
+
+ssize_t IPCThreadState::findAsyncReply(const void* cookie) const
+{
+    const size_t N = mAsyncReplies.size();
+    for (size_t i = 0; i < N; i++) {
+        if (mAsyncReplies[i] == cookie) return i;
+    }
+    return NAME_NOT_FOUND;
+}
+
+void IPCThreadState::completeTaggedReply(const binder_transaction_data& tr)
+{
+    const ssize_t i = tr.cookie != NULL ? findAsyncReply(tr.cookie) : NAME_NOT_FOUND;
+    AsyncReply* call = i >= 0 ? mAsyncReplies[i] : NULL;
+    status_t status = NO_ERROR;
+
+    if (call != NULL) {
+        mAsyncReplies.removeAt(i);
+    } else {
+        LOGE("Dropping reply for unknown transaction %p", tr.cookie);
+    }
+
+    if (call != NULL && (tr.flags & TF_STATUS_CODE) == 0) {
+        call->mReply.ipcSetDataReference(
+            reinterpret_cast<const uint8_t*>(tr.data.ptr.buffer),
+            tr.data_size,
+            reinterpret_cast<const size_t*>(tr.data.ptr.offsets),
+            tr.offsets_size/sizeof(size_t),
+            freeBuffer, this);
+    } else {
+        if (call != NULL) {
+            status = *static_cast<const status_t*>(tr.data.ptr.buffer);
+        }
+        freeBuffer(NULL,
+            reinterpret_cast<const uint8_t*>(tr.data.ptr.buffer),
+            tr.data_size,
+            reinterpret_cast<const size_t*>(tr.data.ptr.offsets),
+            tr.offsets_size/sizeof(size_t), this);
+    }
+
+    if (call != NULL) finishAsyncReply(call, status);
+}
+
+void IPCThreadState::finishAsyncReply(AsyncReply* call, status_t status)
+{
+    call->mStatus = status;
+    if (status != NO_ERROR) call->mReply.setError(status);
+    call->mDone = true;
+    call->onReply(status, call->mReply);
+    call->decStrong(this);
+}
+
 void IPCThreadState::incStrongHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::incStrongHandle(%d)\n", handle);
@@ -637,22 +905,40 @@ status_t IPCThreadState::clearDeathNotification(int32_t handle, BpBinder* proxy)
 IPCThreadState::IPCThreadState()
     : mProcess(ProcessState::self()),
       mMyThreadId(androidGetTid()),
+      mOnewayBatchDepth(0),
+      mOnewayPending(0),
+      mOnewayBatchError(NO_ERROR),
+      mGrowIn(false),
+      mIdleReads(0),
+      mCommandsRead(0),
       mStrictModePolicy(0),
       mLastTransactionBinderFlags(0)
 {
     pthread_setspecific(gTLS, this);
-    clearCaller();
-#ifdef INLINE_TRANSACTION_DATA
-    mIn.setDataCapacity(2048);
-    mOut.setDataCapacity(2048);
-#else
-    mIn.setDataCapacity(256);
-    mOut.setDataCapacity(256);
+#if defined(HAVE_TLS)
+    gSelf = this;
 #endif
+    clearCaller();
+    mIn.setDataCapacity(mProcess->mIpcBufferInitial);
+    mOut.setDataCapacity(mProcess->mIpcBufferInitial);
 }
 
 IPCThreadState::~IPCThreadState()
 {
+    // Replies still outstanding can't be delivered anymore.
+    const size_t N = mAsyncReplies.size();
+    for (size_t i = 0; i < N; i++) {
+        AsyncReply* call = mAsyncReplies[i];
+        call->mStatus = DEAD_OBJECT;
+        call->mReply.setError(DEAD_OBJECT);
+        call->mDone = true;
+        call->decStrong(this);
+    }
+
+    const size_t M = mOnewayBatch.size();
+    for (size_t i = 0; i < M; i++) {
+        delete mOnewayBatch[i];
+    }
 }
 
 status_t IPCThreadState::sendReply(const Parcel& reply, uint32_t flags)
@@ -676,13 +962,23 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
         if (err < NO_ERROR) break;
         if (mIn.dataAvail() == 0) continue;
         
-        cmd = mIn.readInt32();
+        cmd = readCommand();
         
         IF_LOG_COMMANDS() {
             alog << "Processing waitForResponse Command: "
                 << getReturnString(cmd) << endl;
         }
 
+        // Batched oneways were written ahead of whatever we're waiting
+        // for, so their completions come first.  A oneway to a dead target
+        // completes with BR_DEAD_REPLY alone.
+        if (mOnewayPending > 0
+                && (cmd == BR_TRANSACTION_COMPLETE || cmd == BR_FAILED_REPLY
+                    || cmd == BR_DEAD_REPLY)) {
+            executeCommand(cmd);
+            continue;
+        }
+
         switch (cmd) {
         case BR_TRANSACTION_COMPLETE:
             if (!reply && !acquireResult) goto finish;
@@ -721,6 +1017,13 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
 		tr.data.ptr.offsets = (uint8_t *)tr_buf + BUF_ALIGN(tr.data_size);
 #endif
 
+                if (tr.cookie != NULL) {
+                    // A reply to one of our transactAsync() calls, not to
+                    // the transaction being waited for.
+                    completeTaggedReply(tr);
+                    continue;
+                }
+
                 if (reply) {
                     if ((tr.flags & TF_STATUS_CODE) == 0) {
                         reply->ipcSetDataReference(
@@ -765,6 +1068,10 @@ finish:
     return err;
 }
 
+// How long (in ms) talkWithDriver() waits for buffers to be freed when the
+// mapping is full and can't grow.
+static const int MAX_BUFFER_WAITS = 100;
+
 status_t IPCThreadState::talkWithDriver(bool doReceive)
 {
     LOG_ASSERT(mProcess->mDriverFD >= 0, "Binder driver is not opened");
@@ -784,6 +1091,7 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
 
     // This is what we'll read.
     if (doReceive && needRead) {
+        resizeBuffers();
         bwr.read_size = mIn.dataCapacity();
         bwr.read_buffer = (long unsigned int)mIn.data();
     } else {
@@ -811,7 +1119,9 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     bwr.write_consumed = 0;
     bwr.read_consumed = 0;
     status_t err;
+    int bufferWaits = 0;
     do {
+        const int32_t regions = mProcess->mVMRegions;
         IF_LOG_COMMANDS() {
             alog << "About to read/write, write size = " << mOut.dataSize() << endl;
         }
@@ -826,6 +1136,39 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
         IF_LOG_COMMANDS() {
             alog << "Finished read/write, write size = " << mOut.dataSize() << endl;
         }
+
+        // Not even the first command fit; the write still went through.
+        if (err == -ENOSPC && bwr.read_size > 0
+                && mIn.dataCapacity() < mProcess->mIpcBufferMax) {
+            size_t capacity = mIn.dataCapacity() * 2;
+            if (capacity > mProcess->mIpcBufferMax) capacity = mProcess->mIpcBufferMax;
+            mIn.setDataCapacity(capacity);
+            android_atomic_inc(&mProcess->mIpcGrows);
+            bwr.read_size = mIn.dataCapacity();
+            bwr.read_buffer = (long unsigned int)mIn.data();
+            err = -EINTR;
+        }
+
+        // No room left in our mapping for the next incoming transaction;
+        // the driver keeps it queued (a reply would have failed instead).  Map more if allowed, else wait a while for other
+        // threads to free buffers.  The ones holding the mapping may be our
+        // own (e.g. the outer transaction of a nested call), so give up
+        // rather than wait forever.
+        if (err == -ENOBUFS) {
+            if (mProcess->growMapping(regions)) {
+                err = -EINTR;
+            } else if (bufferWaits < MAX_BUFFER_WAITS) {
+                if (bufferWaits++ == 0) {
+                    LOGW("Binder mapping full, waiting for buffers to be freed\n");
+                }
+                usleep(1000);
+                err = -EINTR;
+            } else {
+                LOGE("Binder mapping still full after %d ms, giving up\n",
+                    MAX_BUFFER_WAITS);
+                err = NO_MEMORY;
+            }
+        }
     } while (err == -EINTR);
 
     IF_LOG_COMMANDS() {
@@ -834,17 +1177,33 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
 			<< "), read consumed: " << bwr.read_consumed << endl;
     }
 
+    // The driver reports what it took of the write even when the read
+    // failed, so don't send it again.
+    if (bwr.write_consumed > 0) {
+        if (bwr.write_consumed < (ssize_t)mOut.dataSize())
+            mOut.remove(0, bwr.write_consumed);
+        else
+            mOut.setDataSize(0);
+    }
+
     if (err >= NO_ERROR) {
-        if (bwr.write_consumed > 0) {
-            if (bwr.write_consumed < (ssize_t)mOut.dataSize())
-                mOut.remove(0, bwr.write_consumed);
-            else
-                mOut.setDataSize(0);
-        }
         if (bwr.read_consumed > 0) {
             mIn.setDataSize(bwr.read_consumed);
             mIn.setDataPosition(0);
         }
+        if (bwr.read_size > 0) {
+            // Judge the buffer by how much of it this read needed; it's
+            // resized before the next one, once these commands are done.
+            if ((size_t)bwr.read_consumed + sizeof(int32_t) + sizeof(binder_transaction_data)
+                    > (size_t)bwr.read_size) {
+                mGrowIn = true;
+                mIdleReads = 0;
+            } else if (bwr.read_consumed <= bwr.read_size / 4) {
+                mIdleReads++;
+            } else {
+                mIdleReads = 0;
+            }
+        }
         IF_LOG_COMMANDS() {
             TextOutput::Bundle _b(alog);
             alog << "Remaining data size: " << mOut.dataSize() << endl;
@@ -861,22 +1220,66 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     return err;
 }
 
+int32_t IPCThreadState::readCommand()
+{
+    mCommandsRead++;
+    return mIn.readInt32();
+}
+
+void IPCThreadState::resizeBuffers()
+{
+    // Called with mIn fully consumed, right before it is read into again.
+    android_atomic_inc(&mProcess->mIpcReads);
+    if (mCommandsRead > 0) {
+        android_atomic_add(mCommandsRead, &mProcess->mIpcCommands);
+        mCommandsRead = 0;
+    }
+
+    const size_t initial = mProcess->mIpcBufferInitial;
+    const size_t max = mProcess->mIpcBufferMax;
+    const size_t capacity = mIn.dataCapacity();
+
+    if (mGrowIn) {
+        mGrowIn = false;
+        if (capacity < max) {
+            mIn.setDataCapacity(capacity * 2 < max ? capacity * 2 : max);
+            android_atomic_inc(&mProcess->mIpcGrows);
+        }
+    } else if (mIdleReads >= 64) {
+        mIdleReads = 0;
+        if (capacity > initial) {
+            mIn.freeData();
+            mIn.setDataCapacity(capacity / 2 > initial ? capacity / 2 : initial);
+            android_atomic_inc(&mProcess->mIpcShrinks);
+        }
+        // mOut only ever grows on its own; give back what a burst left behind.
+        if (mOut.dataSize() == 0 && mOut.dataCapacity() > initial) {
+            mOut.freeData();
+            mOut.setDataCapacity(initial);
+        }
+    }
+}
+
 status_t IPCThreadState::writeTransactionData(int32_t cmd, uint32_t binderFlags,
-    int32_t handle, uint32_t code, const Parcel& data, status_t* statusBuffer)
+    int32_t handle, uint32_t code, const Parcel& data, status_t* statusBuffer,
+    void* cookie)
 {
     binder_transaction_data tr;
 
     tr.target.handle = handle;
     tr.code = code;
     tr.flags = binderFlags;
-    tr.cookie = 0;
+    tr.cookie = cookie;
     tr.sender_pid = 0;
     tr.sender_euid = 0;
     
+    // Joining up a segmented parcel can run out of memory; that shows up
+    // in errorCheck() and is sent or returned like any other error.
+    const uint8_t* buffer = data.ipcData();
     const status_t err = data.errorCheck();
     if (err == NO_ERROR) {
         tr.data_size = data.ipcDataSize();
-        tr.data.ptr.buffer = data.ipcData();
+        tr.data.ptr.buffer = buffer;
         tr.offsets_size = data.ipcObjectsCount()*sizeof(size_t);
         tr.data.ptr.offsets = data.ipcObjects();
     } else if (statusBuffer) {
@@ -1092,6 +1495,45 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
             BpBinder *proxy = (BpBinder*)mIn.readInt32();
             proxy->getWeakRefs()->decWeak(proxy);
         } break;
+
+    case BR_TRANSACTION_COMPLETE:
+    case BR_FAILED_REPLY:
+    case BR_DEAD_REPLY:
+        if (mOnewayPending > 0) {
+            onewayCompleted(cmd == BR_FAILED_REPLY ? FAILED_TRANSACTION
+                    : cmd == BR_DEAD_REPLY ? DEAD_OBJECT : NO_ERROR);
+        } else if (cmd == BR_TRANSACTION_COMPLETE) {
+            LOGE("Unexpected BR_TRANSACTION_COMPLETE received from Binder driver\n");
+            result = UNKNOWN_ERROR;
+        } else {
+            // Nothing on this thread is waiting for it any more, e.g. the
+            // call gave up; there's no one left to tell.
+            LOGW("Dropping %s with no call outstanding\n", getReturnString(cmd));
+        }
+        break;
+
+#ifndef INLINE_TRANSACTION_DATA
+    case (int32_t) BR_REPLY:
+        {
+            // Only tagged replies to transactAsync() calls turn up outside
+            // of waitForResponse(), e.g. while the thread is in the pool.
+            binder_transaction_data tr;
+            result = mIn.read(&tr, sizeof(tr));
+            LOG_ASSERT(result == NO_ERROR, "Not enough command data for brREPLY");
+            if (result != NO_ERROR) break;
+            completeTaggedReply(tr);
+        } break;
+#endif
+
+    case (int32_t) BR_DEAD_TAGGED_REPLY:
+        {
+            const ssize_t i = findAsyncReply((void*)mIn.readIntPtr());
+            if (i >= 0) {
+                AsyncReply* call = mAsyncReplies[i];
+                mAsyncReplies.removeAt(i);
+                finishAsyncReply(call, DEAD_OBJECT);
+            }
+        } break;
         
     case BR_FINISHED:
         result = TIMED_OUT;
@@ -1117,10 +1559,39 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
     return result;
 }
 
+void IPCThreadState::processPendingDerefs()
+{
+    // Only once we've cleared the incoming command queue
+    if (mIn.dataPosition() >= mIn.dataSize()) {
+        size_t numPending = mPendingWeakDerefs.size();
+        if (numPending > 0) {
+            for (size_t i = 0; i < numPending; i++) {
+                RefBase::weakref_type* refs = mPendingWeakDerefs[i];
+                refs->decWeak(mProcess.get());
+            }
+            mPendingWeakDerefs.clear();
+        }
+
+        numPending = mPendingStrongDerefs.size();
+        if (numPending > 0) {
+            for (size_t i = 0; i < numPending; i++) {
+                BBinder* obj = mPendingStrongDerefs[i];
+                obj->decStrong(mProcess.get());
+            }
+            mPendingStrongDerefs.clear();
+        }
+    }
+}
+
 void IPCThreadState::threadDestructor(void *st)
 {
 	IPCThreadState* const self = static_cast<IPCThreadState*>(st);
 	if (self) {
+#if defined(HAVE_TLS)
+		// The key's value is already cleared; make sure nothing run
+		// from here on finds the state we are about to delete.
+		gSelf = NULL;
+#endif
 		self->flushCommands();
 #if 1//defined(HAVE_ANDROID_OS)
         ioctl(self->mProcess->mDriverFD, BINDER_THREAD_EXIT, 0);
@@ -1146,4 +1617,28 @@ void IPCThreadState::freeBuffer(Parcel* parcel, const uint8_t* data, size_t data
     state->mOut.writeInt32((int32_t)data);
 }
 
+// ---------------------------------------------------------------------------
+
+AsyncReply::AsyncReply()
+    : mStatus(NO_ERROR), mDone(false)
+{
+}
+
+AsyncReply::~AsyncReply()
+{
+}
+
+status_t AsyncReply::wait()
+{
+    if (!mDone) {
+        const status_t err = IPCThreadState::self()->waitForAsyncReplies(this);
+        if (err != NO_ERROR && !mDone) return err;
+    }
+    return mStatus;
+}
+
+void AsyncReply::onReply(status_t /*status*/, const Parcel& /*reply*/)
+{
+}
+
 }; // namespace android
@@ -39,8 +39,9 @@ public:
 
     virtual bool checkPermission(const String16& permission, int32_t pid, int32_t uid)
     {
+        const Parcel::InterfaceToken& token(IPermissionController::interfaceToken);
         Parcel data, reply;
-        data.writeInterfaceToken(IPermissionController::getInterfaceDescriptor());
+        data.writeInterfaceToken(token);
         data.writeString16(permission);
         data.writeInt32(pid);
         data.writeInt32(uid);
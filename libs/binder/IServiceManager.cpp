@@ -22,8 +22,10 @@
 #include <utils/Log.h>
 #include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/SystemClock.h>
+#include <utils/threads.h>
 
 #include <private/binder/Static.h>
 
@@ -109,8 +111,9 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
                 LOGI("Waiting to check permission %s from uid=%d pid=%d",
                         String8(permission).string(), uid, pid);
             }
-            sleep(1);
-        } else {
+            binder = defaultServiceManager()->waitForService(_permission, seconds(1));
+        }
+        if (binder != NULL) {
             pc = interface_cast<IPermissionController>(binder);
             // Install the new permission controller, and try again.        
             gDefaultServiceManagerLock.lock();
@@ -122,6 +125,225 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
 
 // ----------------------------------------------------------------------
 
+// Handed to the service manager by waitForService(); it calls us back
+// (oneway) as soon as the service is added.
+class ServiceWaiter : public BBinder
+{
+public:
+    ServiceWaiter(const String16& name)
+        : mName(name)
+    {
+    }
+
+    sp<IBinder> wait(const IServiceManager* sm, nsecs_t timeout)
+    {
+        const nsecs_t deadline = systemTime() + timeout;
+        nsecs_t recheck = ms2ns(10);
+
+        mLock.lock();
+        while (mService == NULL) {
+            nsecs_t reltime = recheck;
+            if (timeout >= 0) {
+                const nsecs_t remaining = deadline - systemTime();
+                if (remaining <= 0) break;
+                if (reltime > remaining) reltime = remaining;
+            }
+            mCondition.waitRelative(mLock, reltime);
+            if (mService != NULL) break;
+
+            // The callback needs a binder thread to arrive on, which this
+            // process may not have started, so look for ourselves now and
+            // then too.
+            mLock.unlock();
+            sp<IBinder> svc = sm->checkService(mName);
+            mLock.lock();
+            if (svc != NULL) {
+                mService = svc;
+            } else if (recheck < seconds(1)) {
+                recheck *= 2;
+            }
+        }
+        sp<IBinder> result = mService;
+        mLock.unlock();
+        return result;
+    }
+
+    bool isDone()
+    {
+        AutoMutex _l(mLock);
+        return mService != NULL;
+    }
+
+protected:
+    virtual status_t onTransact(uint32_t code, const Parcel& data,
+                                Parcel* reply, uint32_t flags = 0)
+    {
+        if (code != IServiceManager::SERVICE_ADDED_TRANSACTION) {
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+        String16 name = data.readString16();
+        sp<IBinder> service = data.readStrongBinder();
+        if (name == mName && service != NULL) {
+            AutoMutex _l(mLock);
+            mService = service;
+            mCondition.broadcast();
+        }
+        return NO_ERROR;
+    }
+
+private:
+    const String16  mName;
+    Mutex           mLock;
+    Condition       mCondition;
+    sp<IBinder>     mService;
+};
+
+// ----------------------------------------------------------------------
+
+// Services handed out by the default service manager, by name.  Each entry
+// holds the service and is linked to its death, which is the only time a
+// name's service changes under us short of a re-registration.
+class ServiceCache : public IBinder::DeathRecipient
+{
+public:
+    ServiceCache()
+        : mEnabled(false)
+    {
+        memset(&mStats, 0, sizeof(mStats));
+    }
+
+    bool isEnabled() const { return mEnabled; }
+
+    void setEnabled(bool enabled)
+    {
+        Vector< sp<IBinder> > dropped;
+        AutoMutex _l(mLock);
+        mEnabled = enabled;
+        if (!enabled) {
+            for (size_t i=0; i<mServices.size(); i++) {
+                mServices.valueAt(i)->unlinkToDeath(this);
+                dropped.add(mServices.valueAt(i));
+            }
+            mServices.clear();
+        }
+    }
+
+    sp<IBinder> lookup(const String16& name)
+    {
+        AutoMutex _l(mLock);
+        ssize_t i = mServices.indexOfKey(name);
+        if (i >= 0) {
+            mStats.hits++;
+            return mServices.valueAt(i);
+        }
+        mStats.misses++;
+        return NULL;
+    }
+
+    void add(const String16& name, const sp<IBinder>& service)
+    {
+        AutoMutex _l(mLock);
+        if (!mEnabled || mServices.indexOfKey(name) >= 0) return;
+        // Local services can't die, so there is nothing telling us when
+        // they go away; leave them uncached.
+        if (service->linkToDeath(this) != NO_ERROR) return;
+        mServices.add(name, service);
+    }
+
+    void remove(const String16& name)
+    {
+        sp<IBinder> dropped;
+        AutoMutex _l(mLock);
+        ssize_t i = mServices.indexOfKey(name);
+        if (i >= 0) {
+            dropped = mServices.valueAt(i);
+            dropped->unlinkToDeath(this);
+            mServices.removeItemsAt(i);
+        }
+    }
+
+    void getStats(ServiceCacheStats* outStats)
+    {
+        AutoMutex _l(mLock);
+        *outStats = mStats;
+        outStats->entries = mServices.size();
+    }
+
+    void dump(int fd)
+    {
+        String8 result;
+        AutoMutex _l(mLock);
+        result.appendFormat("Service cache: %s, %d entries\n",
+                mEnabled ? "enabled" : "disabled", (int)mServices.size());
+        result.appendFormat("  hits=%d misses=%d invalidations=%d\n",
+                (int)mStats.hits, (int)mStats.misses, (int)mStats.invalidations);
+        for (size_t i=0; i<mServices.size(); i++) {
+            result.appendFormat("  %s\n", String8(mServices.keyAt(i)).string());
+        }
+        write(fd, result.string(), result.size());
+    }
+
+    virtual void binderDied(const wp<IBinder>& who)
+    {
+        // The same service may be registered under several names.  Let go
+        // of the references outside the lock.
+        Vector< sp<IBinder> > dropped;
+        AutoMutex _l(mLock);
+        for (size_t i=mServices.size(); i>0; i--) {
+            if (mServices.valueAt(i-1).get() == who.unsafe_get()) {
+                dropped.add(mServices.valueAt(i-1));
+                mServices.removeItemsAt(i-1);
+                mStats.invalidations++;
+            }
+        }
+    }
+
+private:
+    Mutex                               mLock;
+    volatile bool                       mEnabled;
+    KeyedVector<String16, sp<IBinder> > mServices;
+    ServiceCacheStats                   mStats;
+};
+
+// Created the first time the cache is enabled and kept for the life of the
+// process, so that proxies it holds are never torn down at exit.
+static ServiceCache* gServiceCache = NULL;
+
+static ServiceCache* serviceCache(bool create)
+{
+    if (gServiceCache != NULL || !create) return gServiceCache;
+    AutoMutex _l(gDefaultServiceManagerLock);
+    if (gServiceCache == NULL) {
+        ServiceCache* cache = new ServiceCache();
+        cache->incStrong(&gServiceCache);
+        gServiceCache = cache;
+    }
+    return gServiceCache;
+}
+
+void setServiceCacheEnabled(bool enabled)
+{
+    ServiceCache* cache = serviceCache(enabled);
+    if (cache != NULL) cache->setEnabled(enabled);
+}
+
+void getServiceCacheStats(ServiceCacheStats* outStats)
+{
+    ServiceCache* cache = serviceCache(false);
+    if (cache != NULL) {
+        cache->getStats(outStats);
+    } else {
+        memset(outStats, 0, sizeof(*outStats));
+    }
+}
+
+void dumpServiceCache(int fd)
+{
+    serviceCache(true)->dump(fd);
+}
+
+// ----------------------------------------------------------------------
+
 class BpServiceManager : public BpInterface<IServiceManager>
 {
 public:
@@ -132,31 +354,98 @@ public:
 
     virtual sp<IBinder> getService(const String16& name) const
     {
-        unsigned n;
-        for (n = 0; n < 5; n++){
-            sp<IBinder> svc = checkService(name);
-            if (svc != NULL) return svc;
-            LOGI("Waiting for service %s...\n", String8(name).string());
-            sleep(1);
-        }
-        return NULL;
+        sp<IBinder> svc = checkService(name);
+        if (svc != NULL) return svc;
+        LOGI("Waiting for service %s...\n", String8(name).string());
+        return waitForService(name, seconds(5));
     }
 
     virtual sp<IBinder> checkService( const String16& name) const
     {
+        ServiceCache* cache = serviceCache(false);
+        if (cache != NULL && cache->isEnabled()) {
+            sp<IBinder> svc = cache->lookup(name);
+            if (svc == NULL) {
+                svc = fetchService(name);
+                if (svc != NULL) cache->add(name, svc);
+            }
+            return svc;
+        }
+        return fetchService(name);
+    }
+
+    sp<IBinder> fetchService(const String16& name) const
+    {
+        const Parcel::InterfaceToken& token(IServiceManager::interfaceToken);
         Parcel data, reply;
-        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
+        data.writeInterfaceToken(token);
         data.writeString16(name);
         remote()->transact(CHECK_SERVICE_TRANSACTION, data, &reply);
         return reply.readStrongBinder();
     }
 
+    virtual Vector< sp<IBinder> > checkServices(const Vector<String16>& names) const
+    {
+        Vector< sp<IBinder> > res;
+        Vector<size_t> missing;
+        ServiceCache* cache = serviceCache(false);
+        const bool cached = cache != NULL && cache->isEnabled();
+
+        const size_t N = names.size();
+        res.insertAt(0, N);
+        for (size_t i=0; i<N; i++) {
+            if (cached) {
+                res.editItemAt(i) = cache->lookup(names[i]);
+            }
+            if (res[i] == NULL) missing.add(i);
+        }
+
+        for (size_t first=0; first<missing.size(); first+=MAX_CHECK_SERVICES) {
+            size_t count = missing.size() - first;
+            if (count > MAX_CHECK_SERVICES) count = MAX_CHECK_SERVICES;
+
+            const Parcel::InterfaceToken& token(IServiceManager::interfaceToken);
+            Parcel data, reply;
+            // Up to MAX_CHECK_SERVICES names outgrow the inline buffer;
+            // size the parcel once rather than growing it name by name.
+            size_t size = Parcel::sizeOfInterfaceToken(token) + sizeof(int32_t);
+            for (size_t i=0; i<count; i++) {
+                size += Parcel::sizeOfString16(names[missing[first+i]]);
+            }
+            data.reserve(size);
+            data.writeInterfaceToken(token);
+            data.writeInt32(count);
+            for (size_t i=0; i<count; i++) {
+                data.writeString16(names[missing[first+i]]);
+            }
+            status_t err = remote()->transact(CHECK_SERVICES_TRANSACTION, data, &reply);
+            if (err == NO_ERROR && (size_t)reply.readInt32() == count) {
+                for (size_t i=0; i<count; i++) {
+                    const size_t idx = missing[first+i];
+                    res.editItemAt(idx) = reply.readStrongBinder();
+                    if (cached && res[idx] != NULL) cache->add(names[idx], res[idx]);
+                }
+            } else {
+                // An older service manager: one lookup at a time.
+                for (size_t i=0; i<count; i++) {
+                    const size_t idx = missing[first+i];
+                    res.editItemAt(idx) = fetchService(names[idx]);
+                    if (cached && res[idx] != NULL) cache->add(names[idx], res[idx]);
+                }
+            }
+        }
+        return res;
+    }
+
     virtual status_t addService(const String16& name, const sp<IBinder>& service)
     {
+        const Parcel::InterfaceToken& token(IServiceManager::interfaceToken);
         Parcel data, reply;
-        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
+        data.writeInterfaceToken(token);
         data.writeString16(name);
         data.writeStrongBinder(service);
+        ServiceCache* cache = serviceCache(false);
+        if (cache != NULL) cache->remove(name);
         status_t err = remote()->transact(ADD_SERVICE_TRANSACTION, data, &reply);
         return err == NO_ERROR ? reply.readExceptionCode() : err;
     }
@@ -167,8 +456,9 @@ public:
         int n = 0;
 
         for (;;) {
+            const Parcel::InterfaceToken& token(IServiceManager::interfaceToken);
             Parcel data, reply;
-            data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
+            data.writeInterfaceToken(token);
             data.writeInt32(n++);
             status_t err = remote()->transact(LIST_SERVICES_TRANSACTION, data, &reply);
             if (err != NO_ERROR)
@@ -177,6 +467,56 @@ public:
         }
         return res;
     }
+
+    virtual sp<IBinder> waitForService(const String16& name, nsecs_t timeout) const
+    {
+        // One waiter per name is handed to the service manager, however
+        // often and from however many threads we wait for it; a waiter
+        // that timed out is still registered and is simply waited on again.
+        sp<ServiceWaiter> waiter;
+        sp<IBinder> svc;
+        {
+            AutoMutex _l(mWaitersLock);
+            ssize_t i = mWaiters.indexOfKey(name);
+            if (i >= 0 && !mWaiters.valueAt(i)->isDone()) {
+                waiter = mWaiters.valueAt(i);
+            } else {
+                // The one before saw the service, which may since have
+                // gone; the service manager has forgotten it either way.
+                if (i >= 0) mWaiters.removeItemsAt(i);
+                waiter = new ServiceWaiter(name);
+                mWaiters.add(name, waiter);
+
+                const Parcel::InterfaceToken& token(IServiceManager::interfaceToken);
+                Parcel data, reply;
+                data.writeInterfaceToken(token);
+                data.writeString16(name);
+                data.writeStrongBinder(waiter);
+                status_t err = remote()->transact(WAIT_FOR_SERVICE_TRANSACTION, data, &reply);
+                if (err == NO_ERROR) {
+                    svc = reply.readStrongBinder();
+                }
+                if (svc != NULL) mWaiters.removeItem(name);
+            }
+        }
+        // If the service manager did not take the waiter (too many waiters,
+        // or it predates WAIT_FOR_SERVICE_TRANSACTION) we end up polling.
+        if (svc == NULL) {
+            svc = waiter->wait(this, timeout);
+        }
+        if (svc != NULL) {
+            AutoMutex _l(mWaitersLock);
+            ssize_t i = mWaiters.indexOfKey(name);
+            if (i >= 0 && mWaiters.valueAt(i) == waiter) mWaiters.removeItemsAt(i);
+        }
+        ServiceCache* cache = serviceCache(false);
+        if (svc != NULL && cache != NULL) cache->add(name, svc);
+        return svc;
+    }
+
+private:
+    mutable Mutex                                       mWaitersLock;
+    mutable KeyedVector<String16, sp<ServiceWaiter> >   mWaiters;
 };
 
 IMPLEMENT_META_INTERFACE(ServiceManager, "android.os.IServiceManager");
@@ -210,6 +550,31 @@ status_t BnServiceManager::onTransact(
             reply->writeInt32(err);
             return NO_ERROR;
         } break;
+        case WAIT_FOR_SERVICE_TRANSACTION: {
+            CHECK_INTERFACE(IServiceManager, data, reply);
+            String16 which = data.readString16();
+            // We don't keep the caller's callback: answer like
+            // CHECK_SERVICE_TRANSACTION and let the caller poll.
+            sp<IBinder> b = const_cast<BnServiceManager*>(this)->checkService(which);
+            reply->writeStrongBinder(b);
+            return NO_ERROR;
+        } break;
+        case CHECK_SERVICES_TRANSACTION: {
+            CHECK_INTERFACE(IServiceManager, data, reply);
+            int32_t count = data.readInt32();
+            if (count < 0 || count > MAX_CHECK_SERVICES) return BAD_VALUE;
+            Vector<String16> names;
+            names.setCapacity(count);
+            for (int32_t i=0; i<count; i++) {
+                names.add(data.readString16());
+            }
+            Vector< sp<IBinder> > list = checkServices(names);
+            reply->writeInt32(count);
+            for (int32_t i=0; i<count; i++) {
+                reply->writeStrongBinder(list[i]);
+            }
+            return NO_ERROR;
+        } break;
         case LIST_SERVICES_TRANSACTION: {
             CHECK_INTERFACE(IServiceManager, data, reply);
             Vector<String16> list = listServices();
@@ -36,10 +36,23 @@
 
 #include <private/binder/binder_module.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#if !defined(HAVE_ASHMEM) && defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC         0x0001U
+#define MFD_ALLOW_SEALING   0x0002U
+#endif
 
 #ifndef INT32_MAX
 #define INT32_MAX ((int32_t)(2147483647))
@@ -58,9 +71,28 @@
 // Note: must be kept in sync with android/os/Parcel.java's EX_HAS_REPLY_HEADER
 #define EX_HAS_REPLY_HEADER -128
 
-// Maximum size of a blob to transfer in-place.
+// Maximum size of a blob to transfer in-place.  Larger blobs, including
+// those written by writeLargeByteArray(), go through shared memory.
 static const size_t IN_PLACE_BLOB_LIMIT = 40 * 1024;
 
+// Smallest segment a segmented parcel will use.
+static const size_t MIN_SEGMENT_SIZE = 4096;
+
+// Parcels with at least this many objects get an offset bitmap the first
+// time an object is read out of order; smaller ones just scan.
+static const size_t OBJECTS_BITMAP_MIN_OBJECTS = 8;
+
+// Heap buffers for parcel data and objects are handed out in power-of-two
+// size classes, from POOL_MIN_BUFFER_SIZE up to POOL_MAX_BUFFER_SIZE, and
+// recycled through a small per-thread pool.  Anything larger goes straight
+// to malloc().
+static const size_t POOL_MIN_BUFFER_SIZE = 512;
+static const size_t POOL_NUM_SIZE_CLASSES = 8;
+static const size_t POOL_MAX_BUFFER_SIZE =
+        POOL_MIN_BUFFER_SIZE << (POOL_NUM_SIZE_CLASSES-1);
+static const size_t POOL_MAX_BUFFERS_PER_CLASS = 4;
+static const size_t POOL_MAX_RETAINED_BYTES = 256 * 1024;
+
 // XXX This can be made public if we want to provide
 // support for typed data.
 struct small_flat_data
@@ -285,7 +317,116 @@ status_t unflatten_binder(const sp<ProcessState>& proc,
 
 // ---------------------------------------------------------------------------
 
+struct parcel_buffer_pool
+{
+    void* buffers[POOL_NUM_SIZE_CLASSES][POOL_MAX_BUFFERS_PER_CLASS];
+    size_t counts[POOL_NUM_SIZE_CLASSES];
+    Parcel::BufferPoolStats stats;
+};
+
+static pthread_once_t gBufferPoolOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gBufferPoolKey;
+
+static void destroyBufferPool(void* st)
+{
+    parcel_buffer_pool* pool = static_cast<parcel_buffer_pool*>(st);
+    for (size_t c=0; c<POOL_NUM_SIZE_CLASSES; c++) {
+        for (size_t i=0; i<pool->counts[c]; i++) {
+            free(pool->buffers[c][i]);
+        }
+    }
+    free(pool);
+}
+
+static void initBufferPoolKey()
+{
+    pthread_key_create(&gBufferPoolKey, destroyBufferPool);
+}
+
+static parcel_buffer_pool* getBufferPool(bool create)
+{
+    pthread_once(&gBufferPoolOnce, initBufferPoolKey);
+    parcel_buffer_pool* pool =
+        static_cast<parcel_buffer_pool*>(pthread_getspecific(gBufferPoolKey));
+    if (pool == NULL && create) {
+        pool = (parcel_buffer_pool*)calloc(1, sizeof(parcel_buffer_pool));
+        if (pool) pthread_setspecific(gBufferPoolKey, pool);
+    }
+    return pool;
+}
+
+// Returns the size class that a buffer of 'size' bytes is served from,
+// or -1 if it is too big to be pooled.
+static ssize_t bufferSizeClass(size_t size)
+{
+    if (size > POOL_MAX_BUFFER_SIZE) return -1;
+    ssize_t c = 0;
+    while ((POOL_MIN_BUFFER_SIZE << c) < size) c++;
+    return c;
+}
+
+static void* allocPooledBuffer(size_t* ioSize)
+{
+    const ssize_t c = bufferSizeClass(*ioSize);
+    if (c < 0) return malloc(*ioSize);
+
+    *ioSize = POOL_MIN_BUFFER_SIZE << c;
+    parcel_buffer_pool* pool = getBufferPool(true);
+    if (pool) {
+        if (pool->counts[c] > 0) {
+            pool->stats.hits++;
+            pool->stats.retainedBytes -= *ioSize;
+            return pool->buffers[c][--pool->counts[c]];
+        }
+        pool->stats.misses++;
+    }
+    return malloc(*ioSize);
+}
+
+static void freePooledBuffer(void* buf, size_t size)
+{
+    // Don't create a pool here: this may run from a thread-exit destructor
+    // after the pool itself has already been torn down.
+    parcel_buffer_pool* pool = getBufferPool(false);
+    if (pool) {
+        const ssize_t c = bufferSizeClass(size);
+        if (c >= 0 && (POOL_MIN_BUFFER_SIZE << c) == size
+                && pool->counts[c] < POOL_MAX_BUFFERS_PER_CLASS
+                && pool->stats.retainedBytes + size <= POOL_MAX_RETAINED_BYTES) {
+            pool->buffers[c][pool->counts[c]++] = buf;
+            pool->stats.recycled++;
+            pool->stats.retainedBytes += size;
+            return;
+        }
+        pool->stats.released++;
+    }
+    free(buf);
+}
+
+void Parcel::getBufferPoolStats(BufferPoolStats* outStats)
+{
+    const parcel_buffer_pool* pool = getBufferPool(false);
+    if (pool) {
+        *outStats = pool->stats;
+    } else {
+        memset(outStats, 0, sizeof(*outStats));
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+struct Parcel::Segment
+{
+    Segment*    next;
+    uint8_t*    data;
+    size_t      size;
+    size_t      capacity;
+};
+
 Parcel::Parcel()
+    : mObjectsBitmap(NULL)
+    , mObjectsBitmapBits(0)
+    , mSegmentSize(0)
 {
     initState();
 }
@@ -297,12 +438,15 @@ Parcel::~Parcel()
 
 const uint8_t* Parcel::data() const
 {
+    if (mSegments && const_cast<Parcel*>(this)->flattenSegments(0) != NO_ERROR) {
+        return NULL;
+    }
     return mData;
 }
 
 size_t Parcel::dataSize() const
 {
-    return (mDataSize > mDataPos ? mDataSize : mDataPos);
+    return mSegmentsSize + (mDataSize > mDataPos ? mDataSize : mDataPos);
 }
 
 size_t Parcel::dataAvail() const
@@ -318,17 +462,18 @@ size_t Parcel::dataAvail() const
 
 size_t Parcel::dataPosition() const
 {
-    return mDataPos;
+    return mSegmentsSize + mDataPos;
 }
 
 size_t Parcel::dataCapacity() const
 {
-    return mDataCapacity;
+    return mSegmentsSize + mDataCapacity;
 }
 
 status_t Parcel::setDataSize(size_t size)
 {
-    status_t err;
+    status_t err = flattenSegments(0);
+    if (err != NO_ERROR) return err;
     err = continueWrite(size);
     if (err == NO_ERROR) {
         mDataSize = size;
@@ -339,16 +484,75 @@ status_t Parcel::setDataSize(size_t size)
 
 void Parcel::setDataPosition(size_t pos) const
 {
+    if (mSegments && const_cast<Parcel*>(this)->flattenSegments(0) != NO_ERROR) {
+        // mData holds only the last segment, so no absolute offset means
+        // anything in it; leave nothing to read (mError is NO_MEMORY).
+        mDataPos = mDataSize;
+        mNextObjectHint = 0;
+        return;
+    }
     mDataPos = pos;
     mNextObjectHint = 0;
 }
 
 status_t Parcel::setDataCapacity(size_t size)
 {
+    const status_t err = flattenSegments(0);
+    if (err != NO_ERROR) return err;
     if (size > mDataCapacity) return continueWrite(size);
     return NO_ERROR;
 }
 
+status_t Parcel::setSegmentSize(size_t size)
+{
+    if (size == 0) {
+        const status_t err = flattenSegments(0);
+        if (err == NO_ERROR) mSegmentSize = 0;
+        return err;
+    }
+    mSegmentSize = size < MIN_SEGMENT_SIZE ? MIN_SEGMENT_SIZE : PAD_SIZE(size);
+    return NO_ERROR;
+}
+
+status_t Parcel::reserve(size_t dataBytes, size_t objectCount)
+{
+    const size_t desired = mDataPos+dataBytes;
+    if (desired < mDataPos) return BAD_VALUE;
+    if (desired > mDataCapacity) {
+        const status_t err = continueWrite(desired);
+        if (err != NO_ERROR) return err;
+    }
+    if (mObjectsSize+objectCount > mObjectsCapacity) {
+        return growObjects(mObjectsSize+objectCount);
+    }
+    return NO_ERROR;
+}
+
+size_t Parcel::sizeOfString8(const String8& str)
+{
+    return sizeof(int32_t) + (str.bytes() > 0 ? PAD_SIZE(str.bytes()+1) : 0);
+}
+
+size_t Parcel::sizeOfString16(const String16& str)
+{
+    return sizeof(int32_t) + PAD_SIZE((str.size()+1)*sizeof(char16_t));
+}
+
+size_t Parcel::sizeOfInterfaceToken(const String16& interface)
+{
+    return sizeof(int32_t) + sizeOfString16(interface);
+}
+
+size_t Parcel::sizeOfInterfaceToken(const InterfaceToken& token)
+{
+    return sizeof(int32_t) + sizeOfString16(token.mDescriptor);
+}
+
+size_t Parcel::sizeOfObject()
+{
+    return sizeof(flat_binder_object);
+}
+
 status_t Parcel::setData(const uint8_t* buffer, size_t len)
 {
     status_t err = restartWrite(len);
@@ -364,6 +568,10 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
 {
     const sp<ProcessState> proc(ProcessState::self());
     status_t err;
+    if (parcel->mSegments) {
+        err = const_cast<Parcel*>(parcel)->flattenSegments(0);
+        if (err != NO_ERROR) return err;
+    }
     const uint8_t *data = parcel->mData;
     const size_t *objects = parcel->mObjects;
     size_t size = parcel->mObjectsSize;
@@ -393,6 +601,14 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
     }
     int numObjects = lastIndex - firstIndex + 1;
 
+    if (numObjects > 0 && mSegmentSize != 0) {
+        // Objects are located by their offset in mData, so they can
+        // only be appended to contiguous data.
+        err = flattenSegments(len);
+        if (err != NO_ERROR) return err;
+        startPos = mDataPos;
+    }
+
     if ((mDataSize+len) > mDataCapacity) {
         // grow data
         err = growData(len);
@@ -411,17 +627,19 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
     if (numObjects > 0) {
         // grow objects
         if (mObjectsCapacity < mObjectsSize + numObjects) {
-            int newSize = ((mObjectsSize + numObjects)*3)/2;
-            size_t *objects =
-                (size_t*)realloc(mObjects, newSize*sizeof(size_t));
+            size_t newSize = (((mObjectsSize + numObjects)*3)/2)*sizeof(size_t);
+            size_t *objects = (size_t*)reallocStorage(mObjects,
+                    mObjectsCapacity*sizeof(size_t), &newSize,
+                    mInlineObjects, sizeof(mInlineObjects));
             if (objects == (size_t*)0) {
                 return NO_MEMORY;
             }
             mObjects = objects;
-            mObjectsCapacity = newSize;
+            mObjectsCapacity = newSize/sizeof(size_t);
         }
         
         // append and acquire objects
+        freeObjectsBitmap();
         int idx = mObjectsSize;
         for (int i = firstIndex; i <= lastIndex; i++) {
             size_t off = objects[i] - offset + startPos;
@@ -485,8 +703,17 @@ bool Parcel::checkInterface(IBinder* binder) const
     return enforceInterface(binder->getInterfaceDescriptor());
 }
 
-bool Parcel::enforceInterface(const String16& interface,
-                              IPCThreadState* threadState) const
+status_t Parcel::writeInterfaceToken(const InterfaceToken& token)
+{
+    if (token.mData == NULL) {
+        return writeInterfaceToken(token.mDescriptor);
+    }
+    writeInt32(IPCThreadState::self()->getStrictModePolicy() |
+               STRICT_MODE_PENALTY_GATHER);
+    return write(token.mData, token.mDataSize);
+}
+
+void Parcel::readStrictModePolicy(IPCThreadState* threadState) const
 {
     int32_t strictPolicy = readInt32();
     if (threadState == NULL) {
@@ -502,16 +729,71 @@ bool Parcel::enforceInterface(const String16& interface,
     } else {
       threadState->setStrictModePolicy(strictPolicy);
     }
-    const String16 str(readString16());
-    if (str == interface) {
+}
+
+bool Parcel::enforceInterface(const String16& interface,
+                              IPCThreadState* threadState) const
+{
+    readStrictModePolicy(threadState);
+    size_t len;
+    const char16_t* str = readString16Inplace(&len);
+    if (str != NULL && len == interface.size()
+            && memcmp(str, interface.string(), len*sizeof(char16_t)) == 0) {
         return true;
     } else {
         LOGW("**** enforceInterface() expected '%s' but read '%s'\n",
-                String8(interface).string(), String8(str).string());
+                String8(interface).string(),
+                str ? String8(str, len).string() : "");
         return false;
     }
 }
 
+bool Parcel::enforceInterface(const InterfaceToken& token,
+                              IPCThreadState* threadState) const
+{
+    if (token.mData == NULL) {
+        return enforceInterface(token.mDescriptor, threadState);
+    }
+    readStrictModePolicy(threadState);
+
+    // The token's bytes are exactly what writeString16() produced, so the
+    // length prefix and the characters are compared in one go.  Only the
+    // padding is left out, since other writers need not zero it.
+    const size_t len = sizeof(int32_t)
+            + (token.mDescriptor.size()+1)*sizeof(char16_t);
+    if ((mDataPos+token.mDataSize) >= mDataPos
+            && (mDataPos+token.mDataSize) <= mDataSize
+            && memcmp(mData+mDataPos, token.mData, len) == 0) {
+        mDataPos += token.mDataSize;
+        return true;
+    }
+
+    size_t strLen;
+    const char16_t* str = readString16Inplace(&strLen);
+    LOGW("**** enforceInterface() expected '%s' but read '%s'\n",
+            String8(token.mDescriptor).string(),
+            str ? String8(str, strLen).string() : "");
+    return false;
+}
+
+Parcel::InterfaceToken::InterfaceToken(const String16& interface)
+    : mDescriptor(interface)
+    , mDataSize(sizeof(int32_t) + PAD_SIZE((interface.size()+1)*sizeof(char16_t)))
+{
+    // Serialize the descriptor once, exactly as writeString16() would.
+    mData = (uint8_t*)calloc(1, mDataSize);
+    if (mData) {
+        *reinterpret_cast<int32_t*>(mData) = interface.size();
+        memcpy(mData+sizeof(int32_t), interface.string(),
+                interface.size()*sizeof(char16_t));
+    }
+}
+
+Parcel::InterfaceToken::~InterfaceToken()
+{
+    free(mData);
+}
+
 const size_t* Parcel::objects() const
 {
     return mObjects;
@@ -727,6 +1009,54 @@ status_t Parcel::writeDupFileDescriptor(int fd)
     return writeFileDescriptor(dup(fd), true /*takeOwnership*/);
 }
 
+// Creates an anonymous shared memory region of len bytes to carry a
+// blob: ashmem where we have it, otherwise a Linux memfd.  Returns the
+// fd, or a negative errno.
+static int create_blob_region(size_t len)
+{
+#if defined(HAVE_ASHMEM)
+    int fd = ashmem_create_region("Parcel Blob", len);
+    if (fd < 0) return -errno;
+    int result = ashmem_set_prot_region(fd, PROT_READ | PROT_WRITE);
+    if (result < 0) {
+        ::close(fd);
+        return result;
+    }
+    return fd;
+#elif defined(__NR_memfd_create)
+    int fd = syscall(__NR_memfd_create, "Parcel Blob",
+            MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -errno;
+    if (ftruncate(fd, len) < 0) {
+        int err = -errno;
+        ::close(fd);
+        return err;
+    }
+#ifdef F_ADD_SEALS
+    // The receiver maps the region, so don't let it change size under it.
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#endif
+    return fd;
+#else
+    return -ENOSYS;
+#endif
+}
+
+// Called once the writer has its mapping: no one else may write to the
+// region from here on.
+static status_t seal_blob_region(int fd)
+{
+#if defined(HAVE_ASHMEM)
+    return ashmem_set_prot_region(fd, PROT_READ);
+#else
+#ifdef F_SEAL_FUTURE_WRITE
+    // Not supported by older kernels; the region is still usable.
+    fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+    return NO_ERROR;
+#endif
+}
+
 status_t Parcel::writeBlob(size_t len, WritableBlob* outBlob)
 {
     status_t status;
@@ -743,32 +1073,22 @@ status_t Parcel::writeBlob(size_t len, WritableBlob* outBlob)
         return NO_ERROR;
     }
 
-#ifndef HAVE_ASHMEM
-    return NO_MEMORY;
-#else
-    LOGV("writeBlob: write to ashmem");
-    int fd = ashmem_create_region("Parcel Blob", len);
+    LOGV("writeBlob: write to shared memory");
+    int fd = create_blob_region(len);
     if (fd < 0) return NO_MEMORY;
 
-    int result = ashmem_set_prot_region(fd, PROT_READ | PROT_WRITE);
-    if (result < 0) {
-        status = result;
+    void* ptr = ::mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        status = -errno;
     } else {
-        void* ptr = ::mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (ptr == MAP_FAILED) {
-            status = -errno;
-        } else {
-            result = ashmem_set_prot_region(fd, PROT_READ);
-            if (result < 0) {
-                status = result;
-            } else {
-                status = writeInt32(1);
+        status = seal_blob_region(fd);
+        if (!status) {
+            status = writeInt32(1);
+            if (!status) {
+                status = writeFileDescriptor(fd, true /*takeOwnership*/);
                 if (!status) {
-                    status = writeFileDescriptor(fd, true /*takeOwnership*/);
-                    if (!status) {
-                        outBlob->init(true /*mapped*/, ptr, len);
-                        return NO_ERROR;
-                    }
+                    outBlob->init(true /*mapped*/, ptr, len);
+                    return NO_ERROR;
                 }
             }
         }
@@ -776,7 +1096,26 @@ status_t Parcel::writeBlob(size_t len, WritableBlob* outBlob)
     }
     ::close(fd);
     return status;
-#endif
+}
+
+status_t Parcel::writeLargeByteArray(size_t len, const uint8_t* val)
+{
+    if (len > (size_t)INT32_MAX || (val == NULL && len > 0)) {
+        return BAD_VALUE;
+    }
+
+    status_t status = writeInt32(len);
+    if (status) return status;
+
+    WritableBlob blob;
+    status = writeBlob(len, &blob);
+    if (status) return status;
+
+    if (len > 0) {
+        memcpy(blob.data(), val, len);
+    }
+    blob.release();
+    return NO_ERROR;
 }
 
 status_t Parcel::write(const Flattenable& val)
@@ -817,6 +1156,13 @@ status_t Parcel::write(const Flattenable& val)
 
 status_t Parcel::writeObject(const flat_binder_object& val, bool nullMetaData)
 {
+    if (mSegmentSize != 0) {
+        // Objects are located by their offset in mData, so they can
+        // only be written to contiguous data.
+        const status_t err = flattenSegments(sizeof(val));
+        if (err != NO_ERROR) return err;
+    }
+
     const bool enoughData = (mDataPos+sizeof(val)) <= mDataCapacity;
     const bool enoughObjects = mObjectsSize < mObjectsCapacity;
     if (enoughData && enoughObjects) {
@@ -828,6 +1174,7 @@ restart_write:
             mObjects[mObjectsSize] = mDataPos;
             acquire_object(ProcessState::self(), val, this);
             mObjectsSize++;
+            freeObjectsBitmap();
         }
         
         // remember if it's a file descriptor
@@ -846,11 +1193,8 @@ restart_write:
         if (err != NO_ERROR) return err;
     }
     if (!enoughObjects) {
-        size_t newSize = ((mObjectsSize+2)*3)/2;
-        size_t* objects = (size_t*)realloc(mObjects, newSize*sizeof(size_t));
-        if (objects == NULL) return NO_MEMORY;
-        mObjects = objects;
-        mObjectsCapacity = newSize;
+        const status_t err = growObjects(((mObjectsSize+2)*3)/2);
+        if (err != NO_ERROR) return err;
     }
     
     goto restart_write;
@@ -927,6 +1271,125 @@ restart_write:
     return err;
 }
 
+template<class T>
+status_t Parcel::writeArray(size_t len, const T* val) {
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(PAD_SIZE(sizeof(T)) == sizeof(T));
+
+    if (len > INT32_MAX/sizeof(T) || (val == NULL && len > 0)) {
+        return BAD_VALUE;
+    }
+
+    const size_t bytes = len*sizeof(T);
+    if ((mDataPos+sizeof(int32_t)+bytes) > mDataCapacity) {
+        status_t err = growData(sizeof(int32_t)+bytes);
+        if (err != NO_ERROR) return err;
+    }
+
+    *reinterpret_cast<int32_t*>(mData+mDataPos) = len;
+    if (bytes > 0) {
+        memcpy(mData+mDataPos+sizeof(int32_t), val, bytes);
+    }
+    return finishWrite(sizeof(int32_t)+bytes);
+}
+
+template<class T>
+const T* Parcel::readArrayInplace(size_t* outLen, bool requireAligned) const {
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(PAD_SIZE(sizeof(T)) == sizeof(T));
+
+    if ((mDataPos+sizeof(int32_t)) > mDataSize) return NULL;
+
+    const int32_t len = *reinterpret_cast<const int32_t*>(mData+mDataPos);
+    const size_t avail = mDataSize-mDataPos-sizeof(int32_t);
+    if (len < 0 || (size_t)len > avail/sizeof(T)) return NULL;
+
+    const uint8_t* data = mData+mDataPos+sizeof(int32_t);
+    if (requireAligned && (reinterpret_cast<uintptr_t>(data) & (sizeof(T)-1)) != 0) {
+        return NULL;
+    }
+
+    mDataPos += sizeof(int32_t)+len*sizeof(T);
+    LOGV("readArrayInplace Setting data pos of %p to %d\n", this, (int)mDataPos);
+    *outLen = len;
+    return reinterpret_cast<const T*>(data);
+}
+
+template<class T>
+status_t Parcel::readArray(T* outVal, size_t* ioLen) const {
+    const size_t startPos = mDataPos;
+    size_t len;
+    const T* data = readArrayInplace<T>(&len, false);
+    if (data == NULL) return NOT_ENOUGH_DATA;
+    if (len > *ioLen) {
+        mDataPos = startPos;
+        return BAD_VALUE;
+    }
+    if (len > 0) {
+        memcpy(outVal, data, len*sizeof(T));
+    }
+    *ioLen = len;
+    return NO_ERROR;
+}
+
+status_t Parcel::writeInt32Array(size_t len, const int32_t* val)
+{
+    return writeArray(len, val);
+}
+
+status_t Parcel::writeInt64Array(size_t len, const int64_t* val)
+{
+    return writeArray(len, val);
+}
+
+status_t Parcel::writeFloatArray(size_t len, const float* val)
+{
+    return writeArray(len, val);
+}
+
+status_t Parcel::writeDoubleArray(size_t len, const double* val)
+{
+    return writeArray(len, val);
+}
+
+status_t Parcel::readInt32Array(int32_t* outVal, size_t* ioLen) const
+{
+    return readArray(outVal, ioLen);
+}
+
+status_t Parcel::readInt64Array(int64_t* outVal, size_t* ioLen) const
+{
+    return readArray(outVal, ioLen);
+}
+
+status_t Parcel::readFloatArray(float* outVal, size_t* ioLen) const
+{
+    return readArray(outVal, ioLen);
+}
+
+status_t Parcel::readDoubleArray(double* outVal, size_t* ioLen) const
+{
+    return readArray(outVal, ioLen);
+}
+
+const int32_t* Parcel::readInt32ArrayInplace(size_t* outLen) const
+{
+    return readArrayInplace<int32_t>(outLen, true);
+}
+
+const int64_t* Parcel::readInt64ArrayInplace(size_t* outLen) const
+{
+    return readArrayInplace<int64_t>(outLen, true);
+}
+
+const float* Parcel::readFloatArrayInplace(size_t* outLen) const
+{
+    return readArrayInplace<float>(outLen, true);
+}
+
+const double* Parcel::readDoubleArrayInplace(size_t* outLen) const
+{
+    return readArrayInplace<double>(outLen, true);
+}
+
 status_t Parcel::readInt32(int32_t *pArg) const
 {
     return readAligned(pArg);
@@ -1101,6 +1564,16 @@ int Parcel::readFileDescriptor() const
     return BAD_TYPE;
 }
 
+status_t Parcel::readLargeByteArray(ReadableBlob* outBlob) const
+{
+    int32_t len;
+    status_t status = readInt32(&len);
+    if (status) return status;
+    if (len < 0) return BAD_VALUE;
+
+    return readBlob(len, outBlob);
+}
+
 status_t Parcel::readBlob(size_t len, ReadableBlob* outBlob) const
 {
     int32_t useAshmem;
@@ -1116,12 +1589,19 @@ status_t Parcel::readBlob(size_t len, ReadableBlob* outBlob) const
         return NO_ERROR;
     }
 
-    LOGV("readBlob: read from ashmem");
+    LOGV("readBlob: read from shared memory");
     int fd = readFileDescriptor();
     if (fd == int(BAD_TYPE)) return BAD_VALUE;
 
+#ifndef HAVE_ASHMEM
+    // Touching a mapping beyond the end of a memfd faults, so don't trust
+    // the sender about its size.
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < len) return BAD_VALUE;
+#endif
+
     void* ptr = ::mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
-    if (!ptr) return NO_MEMORY;
+    if (ptr == MAP_FAILED) return NO_MEMORY;
 
     outBlob->init(true /*mapped*/, ptr, len);
     return NO_ERROR;
@@ -1159,6 +1639,35 @@ status_t Parcel::read(Flattenable& val) const
 
     return err;
 }
+bool Parcel::buildObjectsBitmap() const
+{
+    // One bit per 4-byte word of data.
+    const size_t bits = (mDataSize+3)/4;
+    uint32_t* bitmap = (uint32_t*)calloc((bits+31)/32, sizeof(uint32_t));
+    if (bitmap == NULL) return false;
+
+    for (size_t i=0; i<mObjectsSize; i++) {
+        const size_t off = mObjects[i];
+        // Misaligned offsets can never match an aligned read position.
+        if ((off&3) == 0 && off/4 < bits) {
+            bitmap[off/128] |= 1U << ((off/4)%32);
+        }
+    }
+
+    mObjectsBitmap = bitmap;
+    mObjectsBitmapBits = bits;
+    return true;
+}
+
+void Parcel::freeObjectsBitmap() const
+{
+    if (mObjectsBitmap != NULL) {
+        free(mObjectsBitmap);
+        mObjectsBitmap = NULL;
+        mObjectsBitmapBits = 0;
+    }
+}
+
 const flat_binder_object* Parcel::readObject(bool nullMetaData) const
 {
     const size_t DPOS = mDataPos;
@@ -1178,7 +1687,37 @@ const flat_binder_object* Parcel::readObject(bool nullMetaData) const
         size_t* const OBJS = mObjects;
         const size_t N = mObjectsSize;
         size_t opos = mNextObjectHint;
-        
+
+        // Objects are usually read back in the order they were written,
+        // so the hint normally points right at it.  Otherwise look it up
+        // in the offset bitmap rather than searching for it.
+        if (opos < N && OBJS[opos] == DPOS) {
+            mNextObjectHint = opos+1;
+            LOGV("readObject Setting data pos of %p to %d\n", this, (int)mDataPos);
+            return obj;
+        }
+        if (N >= OBJECTS_BITMAP_MIN_OBJECTS && (DPOS&3) == 0
+                && (mObjectsBitmap != NULL || buildObjectsBitmap())) {
+            const size_t bit = DPOS/4;
+            if (bit < mObjectsBitmapBits
+                    && (mObjectsBitmap[bit/32] & (1U << (bit%32))) != 0) {
+                // Offsets are written in increasing order; find this one's
+                // index so the reads that follow it hit the hint again.
+                size_t lo = 0, hi = N;
+                while (lo < hi) {
+                    const size_t mid = lo + (hi-lo)/2;
+                    if (OBJS[mid] < DPOS) lo = mid+1;
+                    else hi = mid;
+                }
+                if (lo < N && OBJS[lo] == DPOS) mNextObjectHint = lo+1;
+                LOGV("readObject Setting data pos of %p to %d\n", this, (int)mDataPos);
+                return obj;
+            }
+            LOGW("Attempt to read object from Parcel %p at offset %d that is not in the object list",
+                 this, (int)DPOS);
+            return NULL;
+        }
+
         if (N > 0) {
             LOGV("Parcel %p looking for obj at %d, hint=%d\n",
                  this, DPOS, opos);
@@ -1239,12 +1778,20 @@ void Parcel::closeFileDescriptors()
 
 const uint8_t* Parcel::ipcData() const
 {
+    // The driver takes a single buffer, so this is where a segmented
+    // parcel finally gets joined up.
+    if (mSegments) const_cast<Parcel*>(this)->flattenSegments(0);
     return mData;
 }
 
 size_t Parcel::ipcDataSize() const
 {
-    return (mDataSize > mDataPos ? mDataSize : mDataPos);
+    // If the segments couldn't be joined, mData holds only the last one;
+    // send nothing rather than let the driver read past it.
+    if (mSegments && const_cast<Parcel*>(this)->flattenSegments(0) != NO_ERROR) {
+        return 0;
+    }
+    return mDataSize > mDataPos ? mDataSize : mDataPos;
 }
 
 const size_t* Parcel::ipcObjects() const
@@ -1337,32 +1884,138 @@ void Parcel::freeData()
 
 void Parcel::freeDataNoInit()
 {
+    freeObjectsBitmap();
     if (mOwner) {
         //LOGI("Freeing data ref of %p (pid=%d)\n", this, getpid());
         mOwner(this, mData, mDataSize, mObjects, mObjectsSize, mOwnerCookie);
     } else {
         releaseObjects();
-        if (mData) free(mData);
-        if (mObjects) free(mObjects);
+        freeSegments();
+        freeStorage(mData, mDataCapacity, mInlineData);
+        freeStorage(mObjects, mObjectsCapacity*sizeof(size_t), mInlineObjects);
     }
 }
 
 status_t Parcel::growData(size_t len)
 {
+    // A segmented parcel that is only appending plain data retires its
+    // full buffer to the segment chain rather than reallocating it.
+    if (mSegmentSize != 0 && mOwner == NULL && mObjectsSize == 0
+            && mDataSize > 0 && mDataPos == mDataSize
+            && mDataCapacity >= mSegmentSize) {
+        return appendSegment(len);
+    }
+
     size_t newSize = ((mDataSize+len)*3)/2;
+    if (newSize < mSegmentSize) newSize = mSegmentSize;
     return (newSize <= mDataSize)
             ? (status_t) NO_MEMORY
             : continueWrite(newSize);
 }
 
+status_t Parcel::appendSegment(size_t len)
+{
+    Segment* seg = (Segment*)malloc(sizeof(Segment));
+    if (seg == NULL) return NO_MEMORY;
+
+    size_t capacity = len > mSegmentSize ? len : mSegmentSize;
+    uint8_t* data = (uint8_t*)reallocStorage(NULL, 0, &capacity,
+            mInlineData, sizeof(mInlineData));
+    if (data == NULL) {
+        free(seg);
+        return NO_MEMORY;
+    }
+
+    seg->next = NULL;
+    seg->data = mData;
+    seg->size = mDataSize;
+    seg->capacity = mDataCapacity;
+    if (mLastSegment) {
+        mLastSegment->next = seg;
+    } else {
+        mSegments = seg;
+    }
+    mLastSegment = seg;
+    mSegmentsSize += mDataSize;
+
+    mData = data;
+    mDataCapacity = capacity;
+    mDataSize = mDataPos = 0;
+    LOGV("appendSegment Setting data size of %p to %d\n", this, (int)mDataSize);
+    return NO_ERROR;
+}
+
+status_t Parcel::flattenSegments(size_t extra)
+{
+    // Already in one piece; the caller grows it as it needs to.
+    if (mSegments == NULL) return NO_ERROR;
+
+    const size_t size = mSegmentsSize + mDataSize;
+    size_t capacity = size + extra;
+    uint8_t* data = (uint8_t*)reallocStorage(NULL, 0, &capacity,
+            mInlineData, sizeof(mInlineData));
+    if (data == NULL) {
+        LOGE("flattenSegments: unable to allocate %d bytes\n", (int)(size + extra));
+        mError = NO_MEMORY;
+        return NO_MEMORY;
+    }
+
+    size_t pos = 0;
+    for (const Segment* seg = mSegments; seg != NULL; seg = seg->next) {
+        memcpy(data+pos, seg->data, seg->size);
+        pos += seg->size;
+    }
+    memcpy(data+pos, mData, mDataSize);
+    freeSegments();
+    freeStorage(mData, mDataCapacity, mInlineData);
+
+    mData = data;
+    mDataCapacity = capacity;
+    mDataPos += pos;
+    mDataSize = size;
+    LOGV("flattenSegments Setting data size of %p to %d\n", this, (int)mDataSize);
+    return NO_ERROR;
+}
+
+void Parcel::freeSegments()
+{
+    Segment* seg = mSegments;
+    while (seg != NULL) {
+        Segment* next = seg->next;
+        freeStorage(seg->data, seg->capacity, mInlineData);
+        free(seg);
+        seg = next;
+    }
+    mSegments = mLastSegment = NULL;
+    mSegmentsSize = 0;
+}
+
+status_t Parcel::growObjects(size_t count)
+{
+    size_t newSize = count*sizeof(size_t);
+    if (newSize/sizeof(size_t) != count) return NO_MEMORY;
+    size_t* objects = (size_t*)reallocStorage(mObjects,
+            mObjectsCapacity*sizeof(size_t), &newSize,
+            mInlineObjects, sizeof(mInlineObjects));
+    if (objects == NULL) return NO_MEMORY;
+    mObjects = objects;
+    mObjectsCapacity = newSize/sizeof(size_t);
+    return NO_ERROR;
+}
+
 status_t Parcel::restartWrite(size_t desired)
 {
     if (mOwner) {
         freeData();
         return continueWrite(desired);
     }
-    
-    uint8_t* data = (uint8_t*)realloc(mData, desired);
+
+    freeSegments();
+    freeObjectsBitmap();
+
+    size_t capacity = desired;
+    uint8_t* data = (uint8_t*)reallocStorage(mData, mDataCapacity, &capacity,
+            mInlineData, sizeof(mInlineData));
     if (!data && desired > mDataCapacity) {
         mError = NO_MEMORY;
         return NO_MEMORY;
@@ -1372,14 +2025,14 @@ status_t Parcel::restartWrite(size_t desired)
     
     if (data) {
         mData = data;
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
     
     mDataSize = mDataPos = 0;
     LOGV("restartWrite Setting data size of %p to %d\n", this, mDataSize);
     LOGV("restartWrite Setting data pos of %p to %d\n", this, mDataPos);
         
-    free(mObjects);
+    freeStorage(mObjects, mObjectsCapacity*sizeof(size_t), mInlineObjects);
     mObjects = NULL;
     mObjectsSize = mObjectsCapacity = 0;
     mNextObjectHint = 0;
@@ -1406,6 +2059,9 @@ status_t Parcel::continueWrite(size_t desired)
             }
         }
     }
+    if (objectsSize != mObjectsSize) {
+        freeObjectsBitmap();
+    }
     
     if (mOwner) {
         // If the size is going to zero, just release the owner's data.
@@ -1416,16 +2072,21 @@ status_t Parcel::continueWrite(size_t desired)
 
         // If there is a different owner, we need to take
         // posession.
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity = desired;
+        uint8_t* data = (uint8_t*)reallocStorage(NULL, 0, &capacity,
+                mInlineData, sizeof(mInlineData));
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
         }
         size_t* objects = NULL;
+        size_t objectsCapacity = objectsSize*sizeof(size_t);
         
         if (objectsSize) {
-            objects = (size_t*)malloc(objectsSize*sizeof(size_t));
+            objects = (size_t*)reallocStorage(NULL, 0, &objectsCapacity,
+                    mInlineObjects, sizeof(mInlineObjects));
             if (!objects) {
+                freeStorage(data, capacity, mInlineData);
                 mError = NO_MEMORY;
                 return NO_MEMORY;
             }
@@ -1452,8 +2113,9 @@ status_t Parcel::continueWrite(size_t desired)
         mObjects = objects;
         mDataSize = (mDataSize < desired) ? mDataSize : desired;
         LOGV("continueWrite Setting data size of %p to %d\n", this, mDataSize);
-        mDataCapacity = desired;
-        mObjectsSize = mObjectsCapacity = objectsSize;
+        mDataCapacity = capacity;
+        mObjectsSize = objectsSize;
+        mObjectsCapacity = objectsCapacity/sizeof(size_t);
         mNextObjectHint = 0;
 
     } else if (mData) {
@@ -1469,10 +2131,13 @@ status_t Parcel::continueWrite(size_t desired)
                 }
                 release_object(proc, *flat, this);
             }
-            size_t* objects =
-                (size_t*)realloc(mObjects, objectsSize*sizeof(size_t));
+            size_t objectsCapacity = objectsSize*sizeof(size_t);
+            size_t* objects = (size_t*)reallocStorage(mObjects,
+                    mObjectsCapacity*sizeof(size_t), &objectsCapacity,
+                    mInlineObjects, sizeof(mInlineObjects));
             if (objects) {
                 mObjects = objects;
+                mObjectsCapacity = objectsCapacity/sizeof(size_t);
             }
             mObjectsSize = objectsSize;
             mNextObjectHint = 0;
@@ -1480,10 +2145,12 @@ status_t Parcel::continueWrite(size_t desired)
 
         // We own the data, so we can just do a realloc().
         if (desired > mDataCapacity) {
-            uint8_t* data = (uint8_t*)realloc(mData, desired);
+            size_t capacity = desired;
+            uint8_t* data = (uint8_t*)reallocStorage(mData, mDataCapacity,
+                    &capacity, mInlineData, sizeof(mInlineData));
             if (data) {
                 mData = data;
-                mDataCapacity = desired;
+                mDataCapacity = capacity;
             } else if (desired > mDataCapacity) {
                 mError = NO_MEMORY;
                 return NO_MEMORY;
@@ -1501,7 +2168,9 @@ status_t Parcel::continueWrite(size_t desired)
         
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity = desired;
+        uint8_t* data = (uint8_t*)reallocStorage(NULL, 0, &capacity,
+                mInlineData, sizeof(mInlineData));
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -1516,12 +2185,53 @@ status_t Parcel::continueWrite(size_t desired)
         mDataSize = mDataPos = 0;
         LOGV("continueWrite Setting data size of %p to %d\n", this, mDataSize);
         LOGV("continueWrite Setting data pos of %p to %d\n", this, mDataPos);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     return NO_ERROR;
 }
 
+void* Parcel::reallocStorage(void* buf, size_t bufSize, size_t* ioSize,
+                             void* inlineBuf, size_t inlineSize)
+{
+    const size_t desired = *ioSize;
+
+    if (buf != NULL && buf != inlineBuf) {
+        // Already spilled to the heap; stay there.
+        if (desired > POOL_MAX_BUFFER_SIZE && bufSize > POOL_MAX_BUFFER_SIZE) {
+            return realloc(buf, desired);
+        }
+        if (desired <= bufSize && bufSize <= POOL_MAX_BUFFER_SIZE) {
+            *ioSize = bufSize;
+            return buf;
+        }
+        void* heap = allocPooledBuffer(ioSize);
+        if (heap) {
+            memcpy(heap, buf, bufSize < desired ? bufSize : desired);
+            freePooledBuffer(buf, bufSize);
+        }
+        return heap;
+    }
+
+    if (desired <= inlineSize) {
+        // Hand out the whole inline buffer so that later writes don't
+        // come back here until it is actually full.
+        *ioSize = inlineSize;
+        return inlineBuf;
+    }
+
+    void* heap = allocPooledBuffer(ioSize);
+    if (heap && buf) {
+        memcpy(heap, buf, bufSize);
+    }
+    return heap;
+}
+
+void Parcel::freeStorage(void* buf, size_t bufSize, void* inlineBuf)
+{
+    if (buf && buf != inlineBuf) freePooledBuffer(buf, bufSize);
+}
+
 void Parcel::initState()
 {
     mError = NO_ERROR;
@@ -1539,6 +2249,9 @@ void Parcel::initState()
     mFdsKnown = true;
     mAllowFds = true;
     mOwner = NULL;
+    mSegments = NULL;
+    mLastSegment = NULL;
+    mSegmentsSize = 0;
 }
 
 void Parcel::scanForFds() const
@@ -17,6 +17,9 @@
 #define LOG_TAG "PermissionCache"
 
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <cutils/atomic.h>
 #include <utils/Log.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
@@ -31,18 +34,133 @@ ANDROID_SINGLETON_STATIC_INSTANCE(PermissionCache) ;
 
 // ----------------------------------------------------------------------------
 
-PermissionCache::PermissionCache() {
+enum {
+    STATE_EMPTY     = 0,    // invalidated; the next check asks again
+    STATE_GRANTED   = 1,
+    STATE_DENIED    = 2
+};
+
+static const int32_t DEFAULT_NEGATIVE_TTL_MS = 10*1000;
+
+struct PermissionCache::Entry {
+    Entry*              next;
+    String16            name;       // interned
+    uint32_t            hash;
+    uid_t               uid;
+    volatile int32_t    seq;        // odd while state/expires are changing
+    int32_t             state;
+    nsecs_t             expires;    // when a denial stops counting
+};
+
+static inline uint32_t hashPermission(const String16& permission, uid_t uid)
+{
+    const char16_t* s = permission.string();
+    uint32_t h = 2166136261u ^ uid;
+    for (size_t i = permission.size(); i > 0; i--) {
+        h = (h ^ *s++) * 16777619u;
+    }
+    return h;
+}
+
+// The last few answers each thread got, looked up by the address of the
+// caller's string so the common case does not even hash the name.  A
+// slot is only good while its generation matches the cache's.
+struct front_slot {
+    const char16_t*     name;       // interned; never freed
+    size_t              len;
+    uid_t               uid;
+    int32_t             generation;
+    int32_t             state;
+    nsecs_t             expires;
+};
+
+enum { FRONT_SLOTS = 16 };
+
+struct front_cache {
+    front_slot          slots[FRONT_SLOTS];
+};
+
+static pthread_once_t gFrontCacheOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gFrontCacheKey;
+
+static void initFrontCacheKey()
+{
+    pthread_key_create(&gFrontCacheKey, free);
+}
+
+static front_slot* getFrontSlot(const String16& permission, uid_t uid)
+{
+    pthread_once(&gFrontCacheOnce, initFrontCacheKey);
+    front_cache* fc = static_cast<front_cache*>(pthread_getspecific(gFrontCacheKey));
+    if (fc == NULL) {
+        fc = static_cast<front_cache*>(calloc(1, sizeof(front_cache)));
+        if (fc == NULL) return NULL;
+        pthread_setspecific(gFrontCacheKey, fc);
+    }
+    const uintptr_t key = (reinterpret_cast<uintptr_t>(permission.string()) >> 3) ^ uid;
+    return &fc->slots[key & (FRONT_SLOTS-1)];
+}
+
+static inline bool answer(int32_t state, nsecs_t expires, bool* granted)
+{
+    if (state == STATE_GRANTED) {
+        *granted = true;
+        return true;
+    }
+    if (state == STATE_DENIED && systemTime() < expires) {
+        *granted = false;
+        return true;
+    }
+    return false;
+}
+
+PermissionCache::PermissionCache()
+    : mGeneration(0)
+    , mNegativeTtlMs(DEFAULT_NEGATIVE_TTL_MS)
+{
+    for (size_t i=0 ; i<NUM_SHARDS ; i++) {
+        memset((void*)mShards[i].buckets, 0, sizeof(mShards[i].buckets));
+    }
 }
 
 status_t PermissionCache::check(bool* granted,
         const String16& permission, uid_t uid) const {
-    Mutex::Autolock _l(mLock);
-    Entry e;
-    e.name = permission;
-    e.uid  = uid;
-    ssize_t index = mCache.indexOf(e);
-    if (index >= 0) {
-        *granted = mCache.itemAt(index).granted;
+    const int32_t generation = android_atomic_acquire_load(&mGeneration);
+    front_slot* slot = getFrontSlot(permission, uid);
+    if (slot != NULL && slot->generation == generation && slot->uid == uid
+            && slot->name != NULL && slot->len == permission.size()
+            && (slot->name == permission.string() || !memcmp(slot->name,
+                    permission.string(), slot->len*sizeof(char16_t)))
+            && answer(slot->state, slot->expires, granted)) {
+        return NO_ERROR;
+    }
+
+    const uint32_t hash = hashPermission(permission, uid);
+    const Shard& shard(mShards[hash % NUM_SHARDS]);
+    for (const Entry* e = shard.buckets[(hash / NUM_SHARDS) % BUCKETS_PER_SHARD];
+            e != NULL; e = e->next) {
+        if (e->hash != hash || e->uid != uid || e->name != permission) {
+            continue;
+        }
+        int32_t seq, state;
+        nsecs_t expires;
+        do {
+            seq = android_atomic_acquire_load(&e->seq);
+            state = e->state;
+            expires = e->expires;
+        } while ((seq & 1) || android_atomic_release_load(&e->seq) != seq);
+
+        if (!answer(state, expires, granted)) {
+            break;
+        }
+        if (slot != NULL) {
+            slot->name = e->name.string();
+            slot->len = e->name.size();
+            slot->uid = uid;
+            slot->generation = generation;
+            slot->state = state;
+            slot->expires = expires;
+        }
         return NO_ERROR;
     }
     return NAME_NOT_FOUND;
@@ -50,28 +168,87 @@ status_t PermissionCache::check(bool* granted,
 
 void PermissionCache::cache(const String16& permission,
         uid_t uid, bool granted) {
-    Mutex::Autolock _l(mLock);
-    Entry e;
-    ssize_t index = mPermissionNamesPool.indexOf(permission);
-    if (index > 0) {
-        e.name = mPermissionNamesPool.itemAt(index);
-    } else {
-        mPermissionNamesPool.add(permission);
-        e.name = permission;
+    const uint32_t hash = hashPermission(permission, uid);
+    const nsecs_t expires = granted ? 0
+            : systemTime() + ms2ns(android_atomic_acquire_load(&mNegativeTtlMs));
+    Shard& shard(mShards[hash % NUM_SHARDS]);
+    Entry* volatile* bucket = &shard.buckets[(hash / NUM_SHARDS) % BUCKETS_PER_SHARD];
+
+    Mutex::Autolock _l(shard.lock);
+    Entry* e;
+    for (e = *bucket; e != NULL; e = e->next) {
+        if (e->hash == hash && e->uid == uid && e->name == permission) {
+            break;
+        }
     }
+    if (e != NULL) {
+        android_atomic_inc(&e->seq);
+        e->state = granted ? STATE_GRANTED : STATE_DENIED;
+        e->expires = expires;
+        android_atomic_inc(&e->seq);
+        return;
+    }
+
+    e = new Entry;
+    e->name = permission.intern();
     // note, we don't need to store the pid, which is not actually used in
     // permission checks
-    e.uid  = uid;
-    e.granted = granted;
-    index = mCache.indexOf(e);
-    if (index < 0) {
-        mCache.add(e);
+    e->hash = hash;
+    e->uid = uid;
+    e->seq = 0;
+    e->state = granted ? STATE_GRANTED : STATE_DENIED;
+    e->expires = expires;
+    e->next = *bucket;
+    __sync_synchronize();
+    *bucket = e;
+}
+
+void PermissionCache::invalidateUid(uid_t uid) {
+    for (size_t i=0 ; i<NUM_SHARDS ; i++) {
+        Shard& shard(mShards[i]);
+        Mutex::Autolock _l(shard.lock);
+        for (size_t b=0 ; b<BUCKETS_PER_SHARD ; b++) {
+            for (Entry* e = shard.buckets[b]; e != NULL; e = e->next) {
+                if (e->uid == uid && e->state != STATE_EMPTY) {
+                    android_atomic_inc(&e->seq);
+                    e->state = STATE_EMPTY;
+                    android_atomic_inc(&e->seq);
+                }
+            }
+        }
     }
+    android_atomic_inc(&mGeneration);
 }
 
 void PermissionCache::purge() {
-    Mutex::Autolock _l(mLock);
-    mCache.clear();
+    // Lookups may be walking the chains, so entries are emptied rather
+    // than freed; the next check of the same pair reuses them.
+    for (size_t i=0 ; i<NUM_SHARDS ; i++) {
+        Shard& shard(mShards[i]);
+        Mutex::Autolock _l(shard.lock);
+        for (size_t b=0 ; b<BUCKETS_PER_SHARD ; b++) {
+            for (Entry* e = shard.buckets[b]; e != NULL; e = e->next) {
+                if (e->state != STATE_EMPTY) {
+                    android_atomic_inc(&e->seq);
+                    e->state = STATE_EMPTY;
+                    android_atomic_inc(&e->seq);
+                }
+            }
+        }
+    }
+    android_atomic_inc(&mGeneration);
+}
+
+void PermissionCache::invalidate(uid_t uid) {
+    PermissionCache::getInstance().invalidateUid(uid);
+}
+
+void PermissionCache::invalidateAll() {
+    PermissionCache::getInstance().purge();
+}
+
+void PermissionCache::setNegativeTtl(int32_t ms) {
+    android_atomic_release_store(ms, &PermissionCache::getInstance().mNegativeTtlMs);
 }
 
 bool PermissionCache::checkCallingPermission(const String16& permission) {
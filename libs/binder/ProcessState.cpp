@@ -34,15 +34,26 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #define BINDER_VM_SIZE ((1*1024*1024) - (4096 *2))
 
+#ifdef INLINE_TRANSACTION_DATA
+#define IPC_BUFFER_INITIAL 2048
+#else
+#define IPC_BUFFER_INITIAL 256
+#endif
+#define IPC_BUFFER_MAX (64*1024)
+
 
 // ---------------------------------------------------------------------------
 
@@ -71,6 +82,118 @@ protected:
     const bool mIsMain;
 };
 
+static bool gMmapConfigSet = false;
+static BinderMmapConfig gMmapConfig;
+
+// Mappings are whole pages, the total has room for the first one (and a
+// growth, if any), and the bucket geometry is one the driver accepts.
+static bool valid_mmap_config(const BinderMmapConfig& config)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (config.size == 0 || (config.size % page) != 0 || (config.growBy % page) != 0) {
+        return false;
+    }
+    if (config.maxSize != 0 && (config.maxSize < config.size
+            || (config.growBy != 0 && config.maxSize - config.size < config.growBy))) {
+        return false;
+    }
+    if (config.numBuckets != 0 && (config.numBuckets > 16
+            || config.allocSizeShift < 1 || config.allocSizeShift > 16
+            || config.allocSizeShift * (config.numBuckets - 1) >= 31
+            || config.maxAllocSize < sizeof(void*))) {
+        return false;
+    }
+    return true;
+}
+
+status_t ProcessState::setMmapConfig(const BinderMmapConfig& config)
+{
+    if (!valid_mmap_config(config)) {
+        return BAD_VALUE;
+    }
+    AutoMutex _l(gProcessMutex);
+    if (gProcess != NULL) {
+        return INVALID_OPERATION;
+    }
+    gMmapConfig = config;
+    gMmapConfigSet = true;
+    return NO_ERROR;
+}
+
+BinderMmapConfig ProcessState::getMmapConfig() const
+{
+    return mMmapConfig;
+}
+
+// "123", "64k" or "4m"
+static size_t parse_size(const char* s, char** end)
+{
+    size_t size = strtoul(s, end, 0);
+    if (**end == 'k' || **end == 'K') {
+        size *= 1024;
+        (*end)++;
+    } else if (**end == 'm' || **end == 'M') {
+        size *= 1024 * 1024;
+        (*end)++;
+    }
+    return size;
+}
+
+static BinderMmapConfig mmap_config()
+{
+    BinderMmapConfig defaults;
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.size = BINDER_VM_SIZE;
+    BinderMmapConfig config = defaults;
+
+    if (gMmapConfigSet) {
+        return gMmapConfig;
+    }
+
+    const char* env = getenv("BINDER_MMAP");
+    if (env == NULL) {
+        return config;
+    }
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", env);
+    char* save = NULL;
+    for (char* item = strtok_r(buf, ",", &save); item != NULL;
+            item = strtok_r(NULL, ",", &save)) {
+        char* value = strchr(item, '=');
+        char* end;
+        if (value == NULL) {
+            LOGW("BINDER_MMAP: ignoring '%s'", item);
+            continue;
+        }
+        *value++ = '\0';
+        if (!strcmp(item, "size")) {
+            config.size = parse_size(value, &end);
+        } else if (!strcmp(item, "grow")) {
+            config.growBy = parse_size(value, &end);
+        } else if (!strcmp(item, "max")) {
+            config.maxSize = parse_size(value, &end);
+        } else if (!strcmp(item, "buckets")) {
+            config.maxAllocSize = parse_size(value, &end);
+            if (*end == '/') config.allocSizeShift = strtoul(end + 1, &end, 0);
+            if (*end == '/') config.numBuckets = strtoul(end + 1, &end, 0);
+        } else {
+            LOGW("BINDER_MMAP: unknown setting '%s'", item);
+            continue;
+        }
+        if (*end != '\0') {
+            LOGW("BINDER_MMAP: bad value for %s: '%s'", item, value);
+        }
+    }
+
+    if (!valid_mmap_config(config)) {
+        LOGW("BINDER_MMAP: invalid mapping '%s', using the defaults", env);
+        return defaults;
+    }
+    return config;
+}
+
 sp<ProcessState> ProcessState::self()
 {
     if (gProcess != NULL) return gProcess;
@@ -166,46 +289,151 @@ bool ProcessState::becomeContextManager(context_check_func checkFunc, void* user
     return mManagesContexts;
 }
 
-ProcessState::handle_entry* ProcessState::lookupHandleLocked(int32_t handle)
+// ---------------------------------------------------------------------------
+// Handle table readers.
+//
+// getStrongProxyForHandle() and getWeakProxyForHandle() look at the handle
+// table without taking mLock.  Before touching a proxy found in a slot, a
+// reader publishes it in its thread's handle_reader record and checks the
+// slot again; expungeHandle(), which runs from the BpBinder destructor
+// before the object and its weakref_type are freed, clears the slot and
+// then waits until no reader has that proxy published.  Records are never
+// freed: a thread gives its record back when it exits, and the next new
+// thread reuses it.
+
+struct handle_reader {
+    IBinder* volatile   binder;
+    volatile int32_t    inUse;
+    handle_reader*      next;
+};
+
+static handle_reader* volatile gHandleReaders = NULL;
+static pthread_key_t gHandleReaderKey;
+static pthread_once_t gHandleReaderOnce = PTHREAD_ONCE_INIT;
+
+static void releaseHandleReader(void* st)
+{
+    handle_reader* r = static_cast<handle_reader*>(st);
+    r->binder = NULL;
+    android_atomic_release_store(0, &r->inUse);
+}
+
+static void initHandleReaderKey()
+{
+    pthread_key_create(&gHandleReaderKey, releaseHandleReader);
+}
+
+static handle_reader* getHandleReader()
+{
+    pthread_once(&gHandleReaderOnce, initHandleReaderKey);
+    handle_reader* r =
+        static_cast<handle_reader*>(pthread_getspecific(gHandleReaderKey));
+    if (r != NULL) return r;
+
+    for (r = gHandleReaders; r != NULL; r = r->next) {
+        if (r->inUse == 0 && android_atomic_acquire_cas(0, 1, &r->inUse) == 0) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        r = new handle_reader;
+        r->binder = NULL;
+        r->inUse = 1;
+        do {
+            r->next = gHandleReaders;
+        } while (!__sync_bool_compare_and_swap(&gHandleReaders, r->next, r));
+    }
+    pthread_setspecific(gHandleReaderKey, r);
+    return r;
+}
+
+ProcessState::handle_entry* ProcessState::lookupHandle(int32_t handle, bool create)
+{
+    if (handle < 0) return NULL;
+
+    // Bucket n starts at handle (FIRST_HANDLE_BUCKET<<n) - FIRST_HANDLE_BUCKET.
+    const uint32_t v = (uint32_t)handle + FIRST_HANDLE_BUCKET;
+    const int msb = 31 - __builtin_clz(v);
+    const size_t bucket = msb - FIRST_HANDLE_BUCKET_SHIFT;
+    if (bucket >= HANDLE_BUCKETS) return NULL;
+
+    handle_entry* entries = mHandleBuckets[bucket];
+    if (entries == NULL) {
+        if (!create) return NULL;
+        const size_t N = (size_t)FIRST_HANDLE_BUCKET << bucket;
+        handle_entry* fresh = (handle_entry*)calloc(N, sizeof(handle_entry));
+        if (fresh == NULL) return NULL;
+        if (__sync_bool_compare_and_swap(&mHandleBuckets[bucket], NULL, fresh)) {
+            entries = fresh;
+        } else {
+            free(fresh);
+            entries = mHandleBuckets[bucket];
+        }
+    }
+    return &entries[v - (1u << msb)];
+}
+
+// Returns the proxy in e with a new weak reference on it, or NULL if there
+// is none or it is already on its way out.
+IBinder* ProcessState::attemptIncWeakHandle(handle_entry* e)
+{
+    handle_reader* r = getHandleReader();
+    IBinder* b;
+    do {
+        b = e->binder;
+        if (b == NULL) return NULL;
+        r->binder = b;
+        __sync_synchronize();
+    } while (e->binder != b);
+
+    // b can't be freed while it is published in r.  We still need the
+    // attemptIncWeak() because there is a race condition between someone
+    // releasing the last reference on this BpBinder, and a new reference on
+    // its handle arriving from the driver.
+    const bool alive = b->getWeakRefs()->attemptIncWeak(this);
+    __sync_synchronize();
+    r->binder = NULL;
+    return alive ? b : NULL;
+}
+
+void ProcessState::waitForHandleReaders(IBinder* binder)
 {
-    const size_t N=mHandleToObject.size();
-    if (N <= (size_t)handle) {
-        handle_entry e;
-        e.binder = NULL;
-        e.refs = NULL;
-        status_t err = mHandleToObject.insertAt(e, N, handle+1-N);
-        if (err < NO_ERROR) return NULL;
+    __sync_synchronize();
+    for (handle_reader* r = gHandleReaders; r != NULL; r = r->next) {
+        while (r->binder == binder) {
+            sched_yield();
+        }
     }
-    return &mHandleToObject.editItemAt(handle);
 }
 
 sp<IBinder> ProcessState::getStrongProxyForHandle(int32_t handle)
 {
     sp<IBinder> result;
 
-    AutoMutex _l(mLock);
+    handle_entry* e = lookupHandle(handle, true);
+    if (e == NULL) return result;
 
-    handle_entry* e = lookupHandleLocked(handle);
-
-    if (e != NULL) {
+    IBinder* b = attemptIncWeakHandle(e);
+    if (b == NULL) {
         // We need to create a new BpBinder if there isn't currently one, OR we
-        // are unable to acquire a weak reference on this current one.  See comment
-        // in getWeakProxyForHandle() for more info about this.
-        IBinder* b = e->binder;
-        if (b == NULL || !e->refs->attemptIncWeak(this)) {
-            b = new BpBinder(handle); 
-            e->binder = b;
-            if (b) e->refs = b->getWeakRefs();
+        // are unable to acquire a weak reference on this current one.  Only
+        // creation is serialised; check again now that we hold the lock.
+        AutoMutex _l(mLock);
+        b = attemptIncWeakHandle(e);
+        if (b == NULL) {
+            b = new BpBinder(handle);
             result = b;
-        } else {
-            // This little bit of nastyness is to allow us to add a primary
-            // reference to the remote proxy when this team doesn't have one
-            // but another team is sending the handle to us.
-            result.force_set(b);
-            e->refs->decWeak(this);
+            __sync_synchronize();
+            e->binder = b;
+            return result;
         }
     }
 
+    // This little bit of nastyness is to allow us to add a primary
+    // reference to the remote proxy when this team doesn't have one
+    // but another team is sending the handle to us.
+    result.force_set(b);
+    b->getWeakRefs()->decWeak(this);
     return result;
 }
 
@@ -213,43 +441,42 @@ wp<IBinder> ProcessState::getWeakProxyForHandle(int32_t handle)
 {
     wp<IBinder> result;
 
-    AutoMutex _l(mLock);
-
-    handle_entry* e = lookupHandleLocked(handle);
+    handle_entry* e = lookupHandle(handle, true);
+    if (e == NULL) return result;
 
-    if (e != NULL) {        
-        // We need to create a new BpBinder if there isn't currently one, OR we
-        // are unable to acquire a weak reference on this current one.  The
-        // attemptIncWeak() is safe because we know the BpBinder destructor will always
-        // call expungeHandle(), which acquires the same lock we are holding now.
-        // We need to do this because there is a race condition between someone
-        // releasing a reference on this BpBinder, and a new reference on its handle
-        // arriving from the driver.
-        IBinder* b = e->binder;
-        if (b == NULL || !e->refs->attemptIncWeak(this)) {
+    IBinder* b = attemptIncWeakHandle(e);
+    if (b == NULL) {
+        // See getStrongProxyForHandle().
+        AutoMutex _l(mLock);
+        b = attemptIncWeakHandle(e);
+        if (b == NULL) {
             b = new BpBinder(handle);
             result = b;
+            __sync_synchronize();
             e->binder = b;
-            if (b) e->refs = b->getWeakRefs();
-        } else {
-            result = b;
-            e->refs->decWeak(this);
+            return result;
         }
     }
 
+    result = b;
+    b->getWeakRefs()->decWeak(this);
     return result;
 }
 
 void ProcessState::expungeHandle(int32_t handle, IBinder* binder)
 {
-    AutoMutex _l(mLock);
-    
-    handle_entry* e = lookupHandleLocked(handle);
+    handle_entry* e = lookupHandle(handle, false);
 
     // This handle may have already been replaced with a new BpBinder
-    // (if someone failed the AttemptIncWeak() above); we don't want
+    // (if someone failed the attemptIncWeak() above); we don't want
     // to overwrite it.
-    if (e && e->binder == binder) e->binder = NULL;
+    if (e != NULL) {
+        __sync_bool_compare_and_swap(&e->binder, binder, NULL);
+    }
+
+    // Our caller frees binder as soon as we return, so wait for anyone who
+    // picked it out of the table before it was cleared.
+    waitForHandleReaders(binder);
 }
 
 void ProcessState::setArgs(int argc, const char* const argv[])
@@ -294,6 +521,210 @@ void ProcessState::spawnPooledThread(bool isMain)
     }
 }
 
+status_t ProcessState::setIpcBufferSize(size_t initial, size_t max)
+{
+    // Room for at least one command with a transaction
+    if (initial < 64 || max < initial) {
+        return BAD_VALUE;
+    }
+    mIpcBufferInitial = initial;
+    mIpcBufferMax = max;
+    return NO_ERROR;
+}
+
+// Called when the driver had nowhere to put an incoming transaction.
+// seenRegions is mVMRegions from before that read, so concurrent readers
+// that hit the same shortage only map one new region between them.
+bool ProcessState::growMapping(int32_t seenRegions)
+{
+    AutoMutex _l(mLock);
+
+    if (mVMRegions != seenRegions) {
+        return true;
+    }
+    const size_t growBy = mMmapConfig.growBy;
+    if (growBy == 0 || (mDriverFeatures & BINDER_FEATURE_MMAP_REGIONS) == 0
+            || (mMmapConfig.maxSize != 0 && mVMSize + growBy > mMmapConfig.maxSize)) {
+        return false;
+    }
+
+    void* start = mmap(0, growBy, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, mDriverFD, 0);
+    if (start == MAP_FAILED) {
+        LOGW("Growing binder mapping by %u bytes failed: %s\n", (unsigned) growBy,
+                strerror(errno));
+        mMmapConfig.growBy = 0;     // don't keep trying
+        return false;
+    }
+    mVMSize += growBy;
+    android_atomic_inc(&mVMRegions);
+    return true;
+}
+
+IpcBufferStats ProcessState::getIpcBufferStats() const
+{
+    IpcBufferStats stats;
+    stats.reads = mIpcReads;
+    stats.commands = mIpcCommands;
+    stats.grows = mIpcGrows;
+    stats.shrinks = mIpcShrinks;
+    return stats;
+}
+
+// Reads a sysfs CPU list such as "0-3,8-11".
+static bool read_cpu_list(const char* path, cpu_set_t* cpus)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return false;
+
+    CPU_ZERO(cpus);
+    int first, last;
+    char sep;
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        sep = fgetc(f);
+        if (sep == '-') {
+            if (fscanf(f, "%d", &last) != 1) break;
+            sep = fgetc(f);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (sep != ',') break;
+    }
+    fclose(f);
+    return CPU_COUNT(cpus) > 0;
+}
+
+status_t ProcessState::setThreadPoolAffinity(const cpu_set_t& cpus, bool roundRobin)
+{
+    if (CPU_COUNT(&cpus) == 0) {
+        return BAD_VALUE;
+    }
+    AutoMutex _l(mLock);
+    mPoolAffinitySet = true;
+    mPoolRoundRobin = roundRobin;
+    mPoolCpus = cpus;
+    return NO_ERROR;
+}
+
+status_t ProcessState::setThreadPoolSchedPolicy(int policy, int priority)
+{
+    if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (priority < sched_get_priority_min(policy)
+                || priority > sched_get_priority_max(policy)) {
+            return BAD_VALUE;
+        }
+    } else if (policy == SCHED_OTHER || policy == SCHED_BATCH || policy == SCHED_IDLE) {
+        if (priority < -20 || priority > 19) {
+            return BAD_VALUE;
+        }
+    } else {
+        return BAD_VALUE;
+    }
+    AutoMutex _l(mLock);
+    mPoolPolicy = policy;
+    mPoolPriority = priority;
+    return NO_ERROR;
+}
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#define MAX_NUMA_NODES 1024
+
+status_t ProcessState::setThreadPoolNumaNode(int node)
+{
+    if (node < -1 || node >= MAX_NUMA_NODES) {
+        return BAD_VALUE;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (node >= 0) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (!read_cpu_list(path, &cpus)) {
+            return NAME_NOT_FOUND;
+        }
+    }
+    AutoMutex _l(mLock);
+    mPoolNumaNode = node;
+    mPoolNumaCpus = cpus;
+    return NO_ERROR;
+}
+
+
+void ProcessState::applyThreadPoolPolicy()
+{
+    bool haveCpus, roundRobin;
+    cpu_set_t cpus;
+    int policy, priority, node;
+    {
+        AutoMutex _l(mLock);
+        haveCpus = mPoolAffinitySet || mPoolNumaNode >= 0;
+        roundRobin = mPoolRoundRobin;
+        if (mPoolAffinitySet && mPoolNumaNode >= 0) {
+            CPU_AND(&cpus, &mPoolCpus, &mPoolNumaCpus);
+            if (CPU_COUNT(&cpus) == 0) {
+                LOGW("Thread pool CPUs and NUMA node %d don't overlap, using the node", mPoolNumaNode);
+                cpus = mPoolNumaCpus;
+            }
+        } else {
+            cpus = mPoolAffinitySet ? mPoolCpus : mPoolNumaCpus;
+        }
+        policy = mPoolPolicy;
+        priority = mPoolPriority;
+        node = mPoolNumaNode;
+    }
+
+    // 0 is the calling thread for all of these; androidGetTid() may be the
+    // pid where gettid() isn't available.
+    if (haveCpus) {
+        if (roundRobin) {
+            int pick = android_atomic_inc(&mPoolCpuSeq) % CPU_COUNT(&cpus);
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpus) && pick-- == 0) {
+                    CPU_SET(cpu, &one);
+                    break;
+                }
+            }
+            cpus = one;
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            LOGW("Binder thread: sched_setaffinity failed: %s", strerror(errno));
+        }
+    }
+
+    if (policy >= 0) {
+        const bool realtime = policy == SCHED_FIFO || policy == SCHED_RR;
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = realtime ? priority : 0;
+        if (sched_setscheduler(0, policy, &param) != 0) {
+            LOGW("Binder thread: sched_setscheduler(%d) failed: %s",
+                policy, strerror(errno));
+        } else if (!realtime && setpriority(PRIO_PROCESS, 0, priority) != 0) {
+            LOGW("Binder thread: setpriority(%d) failed: %s",
+                priority, strerror(errno));
+        }
+    }
+
+#if defined(__NR_set_mempolicy)
+    if (node >= 0) {
+        const size_t bits = sizeof(unsigned long) * 8;
+        unsigned long nodes[MAX_NUMA_NODES / (sizeof(unsigned long) * 8)];
+        memset(nodes, 0, sizeof(nodes));
+        nodes[node / bits] = 1UL << (node % bits);
+        if (syscall(__NR_set_mempolicy, MPOL_PREFERRED, nodes, sizeof(nodes) * 8 + 1) != 0) {
+            LOGW("Binder thread: set_mempolicy(node %d) failed: %s",
+                node, strerror(errno));
+        }
+    }
+#endif
+}
+
 static int open_driver()
 {
     int fd = open("/dev/binder", O_RDWR);
@@ -324,25 +755,64 @@ static int open_driver()
 
 ProcessState::ProcessState()
     : mDriverFD(open_driver())
+    , mDriverFeatures(0)
     , mVMStart(MAP_FAILED)
+    , mMmapConfig(mmap_config())
+    , mVMSize(0)
+    , mVMRegions(0)
     , mManagesContexts(false)
     , mBinderContextCheckFunc(NULL)
     , mBinderContextUserData(NULL)
     , mThreadPoolStarted(false)
     , mThreadPoolSeq(1)
+    , mIpcBufferInitial(IPC_BUFFER_INITIAL)
+    , mIpcBufferMax(IPC_BUFFER_MAX)
+    , mIpcReads(0)
+    , mIpcCommands(0)
+    , mIpcGrows(0)
+    , mIpcShrinks(0)
+    , mPoolAffinitySet(false)
+    , mPoolRoundRobin(false)
+    , mPoolPolicy(-1)
+    , mPoolPriority(0)
+    , mPoolNumaNode(-1)
+    , mPoolCpuSeq(0)
 {
+    CPU_ZERO(&mPoolCpus);
+    CPU_ZERO(&mPoolNumaCpus);
+    memset((void*)mHandleBuckets, 0, sizeof(mHandleBuckets));
+
     if (mDriverFD >= 0) {
         // XXX Ideally, there should be a specific define for whether we
         // have mmap (or whether we could possibly have the kernel module
         // availabla).
 #if !defined(HAVE_WIN32_IPC)
+        // Drivers without BINDER_GET_FEATURES have none of the extensions.
+        if (ioctl(mDriverFD, BINDER_GET_FEATURES, &mDriverFeatures) < 0) {
+            mDriverFeatures = 0;
+        }
+
+        if (mMmapConfig.numBuckets > 0) {
+            struct binder_mmap_geometry geometry;
+            geometry.max_alloc_size = mMmapConfig.maxAllocSize;
+            geometry.alloc_size_shift = mMmapConfig.allocSizeShift;
+            geometry.num_buckets = mMmapConfig.numBuckets;
+            if ((mDriverFeatures & BINDER_FEATURE_MMAP_REGIONS) == 0
+                    || ioctl(mDriverFD, BINDER_SET_MMAP_GEOMETRY, &geometry) < 0) {
+                LOGW("Binder driver can't set the mmap geometry, using its default\n");
+            }
+        }
+
         // mmap the binder, providing a chunk of virtual address space to receive transactions.
-        mVMStart = mmap(0, BINDER_VM_SIZE, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, mDriverFD, 0);
+        mVMStart = mmap(0, mMmapConfig.size, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, mDriverFD, 0);
         if (mVMStart == MAP_FAILED) {
             // *sigh*
             LOGE("Using /dev/binder failed: unable to mmap transaction memory.\n");
             close(mDriverFD);
             mDriverFD = -1;
+        } else {
+            mVMSize = mMmapConfig.size;
+            mVMRegions = 1;
         }
 #else
         mDriverFD = -1;
@@ -354,6 +824,9 @@ ProcessState::ProcessState()
 
 ProcessState::~ProcessState()
 {
+    for (size_t i=0; i<HANDLE_BUCKETS; i++) {
+        free(mHandleBuckets[i]);
+    }
 }
         
 }; // namespace android
@@ -19,6 +19,7 @@
 #define ANDROID_IINTERFACE_H
 
 #include <binder/Binder.h>
+#include <binder/Parcel.h>
 
 namespace android {
 
@@ -73,6 +74,7 @@ protected:
 
 #define DECLARE_META_INTERFACE(INTERFACE)                               \
     static const android::String16 descriptor;                          \
+    static const android::Parcel::InterfaceToken interfaceToken;        \
     static android::sp<I##INTERFACE> asInterface(                       \
             const android::sp<android::IBinder>& obj);                  \
     virtual const android::String16& getInterfaceDescriptor() const;    \
@@ -81,7 +83,10 @@ protected:
 
 
 #define IMPLEMENT_META_INTERFACE(INTERFACE, NAME)                       \
-    const android::String16 I##INTERFACE::descriptor(NAME);             \
+    const android::String16 I##INTERFACE::descriptor(                   \
+            android::String16(NAME).intern());                          \
+    const android::Parcel::InterfaceToken                               \
+            I##INTERFACE::interfaceToken(I##INTERFACE::descriptor);     \
     const android::String16&                                            \
             I##INTERFACE::getInterfaceDescriptor() const {              \
         return I##INTERFACE::descriptor;                                \
@@ -105,7 +110,9 @@ protected:
 
 
 #define CHECK_INTERFACE(interface, data, reply)                         \
-    if (!data.checkInterface(this)) { return PERMISSION_DENIED; }       \
+    if (!data.enforceInterface(interface::interfaceToken)) {            \
+        return PERMISSION_DENIED;                                       \
+    }                                                                   \
 
 
 // ----------------------------------------------------------------------
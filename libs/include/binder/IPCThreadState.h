@@ -29,6 +29,42 @@ typedef  int  uid_t;
 // ---------------------------------------------------------------------------
 namespace android {
 
+struct binder_transaction_data;
+
+// The pending reply of a two-way transaction sent with
+// IPCThreadState::transactAsync().  Replies are delivered on the thread
+// that issued the call, whenever it next talks to the driver: while it
+// waits in wait() or IPCThreadState::waitForAsyncReplies(), or while it
+// waits for the reply of an ordinary transact().  Subclass and override
+// onReply() to be called back at that point instead of polling.
+class AsyncReply : public virtual RefBase
+{
+public:
+                                AsyncReply();
+
+            bool                isDone() const { return mDone; }
+            status_t            status() const { return mStatus; }
+            const Parcel&       reply() const { return mReply; }
+
+            // Wait for this reply on the issuing thread, delivering any other
+            // replies that arrive first.  Returns status().
+            status_t            wait();
+
+protected:
+    virtual                     ~AsyncReply();
+
+    // Called once the reply (or error) has arrived, with the same values
+    // as status() and reply().
+    virtual void                onReply(status_t status, const Parcel& reply);
+
+private:
+    friend class IPCThreadState;
+
+            Parcel              mReply;
+            status_t            mStatus;
+            bool                mDone;
+};
+
 class IPCThreadState
 {
 public:
@@ -54,6 +90,13 @@ public:
             void                flushCommands();
 
             void                joinThreadPool(bool isMain = true);
+
+            // Serve binder calls from this thread's own event loop instead of
+            // joinThreadPool(): poll *fd for input, and call
+            // handlePolledCommands() whenever it becomes readable.  Returns
+            // INVALID_OPERATION if the driver can't do non-blocking reads.
+            status_t            setupPolling(int* fd);
+            status_t            handlePolledCommands();
             
             // Stop the local process.
             void                stopProcess(bool immediate = true);
@@ -62,6 +105,29 @@ public:
                                          uint32_t code, const Parcel& data,
                                          Parcel* reply, uint32_t flags);
 
+            // Send a two-way transaction without waiting for its reply, which
+            // is delivered to 'reply' later on this thread.  Several calls may
+            // be outstanding at once.  Returns INVALID_OPERATION if the driver
+            // can't tag replies (BINDER_FEATURE_TAGGED_REPLY); callers should
+            // fall back to transact().
+            status_t            transactAsync(int32_t handle,
+                                              uint32_t code, const Parcel& data,
+                                              const sp<AsyncReply>& reply,
+                                              uint32_t flags = 0);
+
+            // Process incoming commands until 'until' is done, or if it is
+            // NULL, until every transactAsync() of this thread has completed.
+            status_t            waitForAsyncReplies(const sp<AsyncReply>& until = NULL);
+
+            // Between these, oneway transact() calls from this thread are
+            // queued and handed to the driver together (at the outermost
+            // endOnewayBatch(), before any call that waits for the driver, or
+            // once MAX_ONEWAY_BATCH are queued) instead of one ioctl each.
+            // endOnewayBatch() returns the first error of the batch.
+            enum { MAX_ONEWAY_BATCH = 64 };
+            void                beginOnewayBatch();
+            status_t            endOnewayBatch();
+
             void                incStrongHandle(int32_t handle);
             void                decStrongHandle(int32_t handle);
             void                incWeakHandle(int32_t handle);
@@ -90,13 +156,24 @@ private:
             status_t            waitForResponse(Parcel *reply,
                                                 status_t *acquireResult=NULL);
             status_t            talkWithDriver(bool doReceive=true);
+            int32_t             readCommand();
+            void                resizeBuffers();
             status_t            writeTransactionData(int32_t cmd,
                                                      uint32_t binderFlags,
                                                      int32_t handle,
                                                      uint32_t code,
                                                      const Parcel& data,
-                                                     status_t* statusBuffer);
+                                                     status_t* statusBuffer,
+                                                     void* cookie = NULL);
             status_t            executeCommand(int32_t command);
+            void                processPendingDerefs();
+            status_t            queueOneway(int32_t handle, uint32_t code,
+                                            const Parcel& data, uint32_t flags);
+            status_t            flushOnewayBatch();
+            void                onewayCompleted(status_t err);
+            ssize_t             findAsyncReply(const void* cookie) const;
+            void                completeTaggedReply(const binder_transaction_data& tr);
+            void                finishAsyncReply(AsyncReply* call, status_t status);
             
             void                clearCaller();
             
@@ -110,9 +187,17 @@ private:
     const   pid_t               mMyThreadId;
             Vector<BBinder*>    mPendingStrongDerefs;
             Vector<RefBase::weakref_type*> mPendingWeakDerefs;
+            Vector<AsyncReply*> mAsyncReplies;
+            int32_t             mOnewayBatchDepth;
+            Vector<Parcel*>     mOnewayBatch;       // copies until completed
+            size_t              mOnewayPending;     // BR_TRANSACTION_COMPLETEs owed
+            status_t            mOnewayBatchError;
             
             Parcel              mIn;
             Parcel              mOut;
+            bool                mGrowIn;            // last read came back full
+            uint32_t            mIdleReads;         // reads using <1/4 of mIn since
+            uint32_t            mCommandsRead;      // since the last read
             status_t            mLastError;
             pid_t               mCallingPid;
             uid_t               mCallingUid;
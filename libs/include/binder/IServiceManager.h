@@ -22,6 +22,7 @@
 #include <binder/IPermissionController.h>
 #include <utils/Vector.h>
 #include <utils/String16.h>
+#include <utils/Timers.h>
 
 namespace android {
 
@@ -54,11 +55,41 @@ public:
      */
     virtual Vector<String16>    listServices() = 0;
 
+    /**
+     * Retrieve a service, blocking until it is registered or the
+     * timeout (in nanoseconds) expires.  A negative timeout waits
+     * forever.  Returns NULL on timeout.
+     */
+    virtual sp<IBinder>         waitForService( const String16& name,
+                                                nsecs_t timeout) const = 0;
+
+    /**
+     * Retrieve several existing services in one call, non-blocking.
+     * The result has one entry per name, in order, NULL for the ones
+     * that are not registered.
+     */
+    virtual Vector< sp<IBinder> > checkServices( const Vector<String16>& names) const = 0;
+
     enum {
         GET_SERVICE_TRANSACTION = IBinder::FIRST_CALL_TRANSACTION,
         CHECK_SERVICE_TRANSACTION,
         ADD_SERVICE_TRANSACTION,
         LIST_SERVICES_TRANSACTION,
+        WAIT_FOR_SERVICE_TRANSACTION,
+        CHECK_SERVICES_TRANSACTION,
+    };
+
+    // Most names the service manager takes in one CHECK_SERVICES_TRANSACTION;
+    // checkServices() splits longer lists.
+    enum {
+        MAX_CHECK_SERVICES = 32
+    };
+
+    // Transaction code of the oneway call the service manager makes on the
+    // callback passed with WAIT_FOR_SERVICE_TRANSACTION once the service is
+    // added: the service name, then the service.
+    enum {
+        SERVICE_ADDED_TRANSACTION = IBinder::FIRST_CALL_TRANSACTION
     };
 };
 
@@ -75,6 +106,33 @@ status_t getService(const String16& name, sp<INTERFACE>* outService)
     return NAME_NOT_FOUND;
 }
 
+template<typename INTERFACE>
+status_t waitForService(const String16& name, nsecs_t timeout,
+                        sp<INTERFACE>* outService)
+{
+    const sp<IServiceManager> sm = defaultServiceManager();
+    if (sm != NULL) {
+        *outService = interface_cast<INTERFACE>(sm->waitForService(name, timeout));
+        if ((*outService) != NULL) return NO_ERROR;
+    }
+    return NAME_NOT_FOUND;
+}
+
+// Opt-in per-process cache of the services returned by the default
+// service manager.  Entries hold the service and are dropped when it dies,
+// so repeated checkService()/getService() calls for a live service do not
+// go back to the service manager.  Off by default; disabling it empties it.
+void setServiceCacheEnabled(bool enabled);
+
+struct ServiceCacheStats {
+    size_t          hits;           // lookups answered from the cache
+    size_t          misses;         // lookups that went to the service manager
+    size_t          invalidations;  // entries dropped because the service died
+    size_t          entries;        // services currently cached
+};
+void getServiceCacheStats(ServiceCacheStats* outStats);
+void dumpServiceCache(int fd);
+
 bool checkCallingPermission(const String16& permission);
 bool checkCallingPermission(const String16& permission,
                             int32_t* outPid, int32_t* outUid);
@@ -40,6 +40,7 @@ class Parcel
 public:
     class ReadableBlob;
     class WritableBlob;
+    class InterfaceToken;
 
                         Parcel();
                         ~Parcel();
@@ -53,6 +54,26 @@ public:
     status_t            setDataSize(size_t size);
     void                setDataPosition(size_t pos) const;
     status_t            setDataCapacity(size_t size);
+
+    // Makes room for at least dataBytes more bytes of data and objectCount
+    // more objects at the current position, so that the writes which follow
+    // do not reallocate.  Use the sizeOf*() helpers to compute dataBytes.
+    status_t            reserve(size_t dataBytes, size_t objectCount = 0);
+
+    // Lets a large parcel grow as a chain of segments of (at least) the
+    // given size instead of one buffer that is reallocated and copied as
+    // it grows.  The segments are joined the first time the data is needed
+    // in one piece: a read, data(), writing an object, or sending it.
+    // If joining them fails, data() returns NULL and errorCheck() reports
+    // NO_MEMORY.  Pass 0 to turn segmenting off again.
+    status_t            setSegmentSize(size_t size);
+
+    // Number of bytes the corresponding write call adds to a parcel.
+    static size_t       sizeOfString8(const String8& str);
+    static size_t       sizeOfString16(const String16& str);
+    static size_t       sizeOfInterfaceToken(const String16& interface);
+    static size_t       sizeOfInterfaceToken(const InterfaceToken& token);
+    static size_t       sizeOfObject();
     
     status_t            setData(const uint8_t* buffer, size_t len);
 
@@ -66,6 +87,7 @@ public:
 
     // Writes the RPC header.
     status_t            writeInterfaceToken(const String16& interface);
+    status_t            writeInterfaceToken(const InterfaceToken& token);
 
     // Parses the RPC header, returning true if the interface name
     // in the header matches the expected interface from the caller.
@@ -76,6 +98,8 @@ public:
     // passed in.
     bool                enforceInterface(const String16& interface,
                                          IPCThreadState* threadState = NULL) const;
+    bool                enforceInterface(const InterfaceToken& token,
+                                         IPCThreadState* threadState = NULL) const;
     bool                checkInterface(IBinder*) const;
 
     void                freeData();
@@ -94,6 +118,11 @@ public:
     status_t            writeFloat(float val);
     status_t            writeDouble(double val);
     status_t            writeIntPtr(intptr_t val);
+    // Write an int32 element count followed by the packed elements.
+    status_t            writeInt32Array(size_t len, const int32_t* val);
+    status_t            writeInt64Array(size_t len, const int64_t* val);
+    status_t            writeFloatArray(size_t len, const float* val);
+    status_t            writeDoubleArray(size_t len, const double* val);
     status_t            writeCString(const char* str);
     status_t            writeString8(const String8& str);
     status_t            writeString16(const String16& str);
@@ -123,6 +152,13 @@ public:
     // The caller should call release() on the blob after writing its contents.
     status_t            writeBlob(size_t len, WritableBlob* outBlob);
 
+    // Writes a byte array that may be large: an int32 length, then a blob
+    // as writeBlob() writes it (an int32 flag, then either the bytes in
+    // place or, for large arrays, the file descriptor of a shared memory
+    // region holding them).  This is not the length-plus-bytes format of
+    // Parcel.java's writeByteArray(); only readLargeByteArray() reads it.
+    status_t            writeLargeByteArray(size_t len, const uint8_t* val);
+
     status_t            writeObject(const flat_binder_object& val, bool nullMetaData);
 
     // Like Parcel.java's writeNoException().  Just writes a zero int32.
@@ -145,6 +181,25 @@ public:
     intptr_t            readIntPtr() const;
     status_t            readIntPtr(intptr_t *pArg) const;
 
+    // Read an array written by the matching write*Array().  On entry *ioLen
+    // is the capacity of outVal in elements, on return the number read;
+    // BAD_VALUE is returned (and nothing consumed) if the array won't fit.
+    status_t            readInt32Array(int32_t* outVal, size_t* ioLen) const;
+    status_t            readInt64Array(int64_t* outVal, size_t* ioLen) const;
+    status_t            readFloatArray(float* outVal, size_t* ioLen) const;
+    status_t            readDoubleArray(double* outVal, size_t* ioLen) const;
+
+    // Return a pointer to the array elements inside the parcel, or NULL if
+    // the array is malformed or not suitably aligned for in-place access
+    // (in which case nothing is consumed and the copying read can be used).
+    // Parcel data is only 4-byte aligned, so the 64-bit variants fail for
+    // any array whose elements don't happen to start on an 8-byte boundary;
+    // callers must be ready to fall back to read*Array().
+    const int32_t*      readInt32ArrayInplace(size_t* outLen) const;
+    const int64_t*      readInt64ArrayInplace(size_t* outLen) const;
+    const float*        readFloatArrayInplace(size_t* outLen) const;
+    const double*       readDoubleArrayInplace(size_t* outLen) const;
+
     const char*         readCString() const;
     String8             readString8() const;
     String16            readString16() const;
@@ -175,6 +230,12 @@ public:
     // The caller should call release() on the blob after reading its contents.
     status_t            readBlob(size_t len, ReadableBlob* outBlob) const;
 
+    // Reads an array written by writeLargeByteArray().  Large arrays are
+    // mapped read-only rather than copied; the array's length is
+    // outBlob->size().  The caller should call release() on the blob when
+    // done with it.
+    status_t            readLargeByteArray(ReadableBlob* outBlob) const;
+
     const flat_binder_object* readObject(bool nullMetaData) const;
 
     // Explicitly close all file descriptors in the parcel.
@@ -195,6 +256,18 @@ public:
     
     void                print(TextOutput& to, uint32_t flags = 0) const;
 
+    // Heap buffers that parcels spill into once they outgrow their inline
+    // storage are recycled through a per-thread pool.  These are the
+    // calling thread's pool counters.
+    struct BufferPoolStats {
+        size_t          hits;           // allocations served from the pool
+        size_t          misses;         // allocations that fell back to malloc()
+        size_t          recycled;       // buffers returned to the pool
+        size_t          released;       // buffers freed because the pool was full
+        size_t          retainedBytes;  // bytes currently held by the pool
+    };
+    static void         getBufferPoolStats(BufferPoolStats* outStats);
+
 private:
                         Parcel(const Parcel& o);
     Parcel&             operator=(const Parcel& o);
@@ -203,11 +276,18 @@ private:
     void                releaseObjects();
     void                acquireObjects();
     status_t            growData(size_t len);
+    status_t            growObjects(size_t count);
+    status_t            appendSegment(size_t len);
+    status_t            flattenSegments(size_t extra);
+    void                freeSegments();
     status_t            restartWrite(size_t desired);
     status_t            continueWrite(size_t desired);
     void                freeDataNoInit();
     void                initState();
     void                scanForFds() const;
+    void                readStrictModePolicy(IPCThreadState* threadState) const;
+    bool                buildObjectsBitmap() const;
+    void                freeObjectsBitmap() const;
                         
     template<class T>
     status_t            readAligned(T *pArg) const;
@@ -217,6 +297,26 @@ private:
     template<class T>
     status_t            writeAligned(T val);
 
+    template<class T>
+    status_t            writeArray(size_t len, const T* val);
+
+    template<class T>
+    status_t            readArray(T* outVal, size_t* ioLen) const;
+
+    template<class T>
+    const T*            readArrayInplace(size_t* outLen, bool requireAligned) const;
+
+    void*               reallocStorage(void* buf, size_t bufSize, size_t* ioSize,
+                                       void* inlineBuf, size_t inlineSize);
+    void                freeStorage(void* buf, size_t bufSize, void* inlineBuf);
+
+    // Sizes of the storage embedded in every Parcel.  Typical transactions
+    // fit entirely in here, so they never touch the heap.
+    enum {
+        INLINE_DATA_CAPACITY    = 256,
+        INLINE_OBJECTS_CAPACITY = 4
+    };
+
     status_t            mError;
     uint8_t*            mData;
     size_t              mDataSize;
@@ -226,6 +326,10 @@ private:
     size_t              mObjectsSize;
     size_t              mObjectsCapacity;
     mutable size_t      mNextObjectHint;
+    // Bit n is set if an object starts at data offset 4*n; built on demand
+    // by readObject().
+    mutable uint32_t*   mObjectsBitmap;
+    mutable size_t      mObjectsBitmapBits;
 
     mutable bool        mFdsKnown;
     mutable bool        mHasFds;
@@ -234,6 +338,18 @@ private:
     release_func        mOwner;
     void*               mOwnerCookie;
 
+    struct Segment;
+    Segment*            mSegments;
+    Segment*            mLastSegment;
+    size_t              mSegmentsSize;
+    size_t              mSegmentSize;
+
+    size_t              mInlineObjects[INLINE_OBJECTS_CAPACITY];
+    union {
+        uint8_t         mInlineData[INLINE_DATA_CAPACITY];
+        int64_t         mInlineDataAlign;
+    };
+
     class Blob {
     public:
         Blob();
@@ -252,6 +368,26 @@ private:
     };
 
 public:
+    // An interface descriptor serialized once up front, so that writing
+    // and enforcing the RPC header is a single memcpy/memcmp.  Every
+    // interface declared with DECLARE_META_INTERFACE has one.
+    class InterfaceToken {
+    public:
+        explicit InterfaceToken(const String16& interface);
+        ~InterfaceToken();
+
+        inline const String16& descriptor() const { return mDescriptor; }
+
+    private:
+        friend class Parcel;
+        InterfaceToken(const InterfaceToken&);
+        InterfaceToken& operator=(const InterfaceToken&);
+
+        const String16  mDescriptor;
+        uint8_t*        mData;
+        const size_t    mDataSize;
+    };
+
     class ReadableBlob : public Blob {
         friend class Parcel;
     public:
@@ -29,31 +29,45 @@ namespace android {
 /*
  * PermissionCache caches permission checks for a given uid.
  *
- * Currently the cache is not updated when there is a permission change,
- * for instance when an application is uninstalled.
+ * The cache is not updated by itself when there is a permission change,
+ * for instance when an application is uninstalled: grants stay until
+ * invalidate() is called for the uid, denials for a short while.
  *
  * IMPORTANT: for the reason stated above, only system permissions are safe
  * to cache. This restriction may be lifted at a later time.
  *
+ * Entries are never freed, not even by invalidate() or invalidateAll(), so
+ * memory grows with the number of distinct (permission, uid) pairs ever
+ * checked in the process.
+ *
  */
 
 class PermissionCache : Singleton<PermissionCache> {
-    struct Entry {
-        String16    name;
-        uid_t       uid;
-        bool        granted;
-        inline bool operator < (const Entry& e) const {
-            return (uid == e.uid) ? (name < e.name) : (uid < e.uid);
-        }
+    // One (permission, uid) pair.  Entries are never freed once published,
+    // so lookups can walk the hash chains without taking a lock; results
+    // change under a sequence counter.
+    struct Entry;
+
+    enum {
+        NUM_SHARDS          = 16,
+        BUCKETS_PER_SHARD   = 64
+    };
+
+    struct Shard {
+        Mutex               lock;   // taken by writers only
+        Entry* volatile     buckets[BUCKETS_PER_SHARD];
     };
-    mutable Mutex mLock;
-    // we pool all the permission names we see, as many permissions checks
-    // will have identical names
-    SortedVector< String16 > mPermissionNamesPool;
-    // this is our cache per say. it stores pooled names.
-    SortedVector< Entry > mCache;
-
-    // free the whole cache, but keep the permission name pool
+
+    Shard mShards[NUM_SHARDS];
+
+    // bumped by every invalidation so that per-thread front caches drop
+    // what they remember
+    volatile int32_t mGeneration;
+
+    // how long a denial is remembered; grants are kept until invalidated
+    volatile int32_t mNegativeTtlMs;
+
+    // empty every entry in place; nothing is freed
     void purge();
 
     status_t check(bool* granted,
@@ -61,6 +75,8 @@ class PermissionCache : Singleton<PermissionCache> {
 
     void cache(const String16& permission, uid_t uid, bool granted);
 
+    void invalidateUid(uid_t uid);
+
 public:
     PermissionCache();
 
@@ -71,6 +87,15 @@ public:
 
     static bool checkPermission(const String16& permission,
             pid_t pid, uid_t uid);
+
+    // Forget everything cached for uid, e.g. once its package changed.
+    static void invalidate(uid_t uid);
+
+    // Forget everything.
+    static void invalidateAll();
+
+    // Set how long (in milliseconds) a denied check is cached for.
+    static void setNegativeTtl(int32_t ms);
 };
 
 // ---------------------------------------------------------------------------
@@ -24,6 +24,8 @@
 
 #include <utils/threads.h>
 
+#include <sched.h>
+
 // ---------------------------------------------------------------------------
 namespace android {
 
@@ -34,11 +36,40 @@ extern int                 mArgLen;
 
 class IPCThreadState;
 
+struct IpcBufferStats {
+    uint32_t reads;         // BINDER_WRITE_READ calls that asked for input
+    uint32_t commands;      // commands they returned
+    uint32_t grows;         // per-thread read buffer growths
+    uint32_t shrinks;       // ... and shrinks back after idling
+};
+
+// The memory the driver delivers incoming transactions into.
+struct BinderMmapConfig {
+    size_t      size;               // first mapping, in bytes
+    size_t      growBy;             // each further mapping once buffers run
+                                    // out; 0 to wait for buffers instead
+    size_t      maxSize;            // all mappings together; 0 for no limit
+    // How the driver divides a mapping: numBuckets buckets of buffers up
+    // to maxAllocSize, each allocSizeShift bits smaller than the next.
+    // numBuckets 0 leaves it to the driver.
+    uint32_t    maxAllocSize;
+    uint32_t    allocSizeShift;
+    uint32_t    numBuckets;
+};
+
 class ProcessState : public virtual RefBase
 {
 public:
     static  sp<ProcessState>    self();
 
+    // Only before the first self().  Otherwise the BINDER_MMAP environment
+    // variable is used if set, e.g. "size=4m,grow=1m,max=16m,buckets=128k/3/4",
+    // with anything it leaves out at the built-in default.  Sizes must be
+    // whole pages and maxSize leave room for size plus a growBy; a config
+    // that doesn't is BAD_VALUE here, and the defaults in BINDER_MMAP.
+    static  status_t            setMmapConfig(const BinderMmapConfig& config);
+            BinderMmapConfig    getMmapConfig() const;
+
             void                setContextObject(const sp<IBinder>& object);
             sp<IBinder>         getContextObject(const sp<IBinder>& caller);
         
@@ -69,7 +100,27 @@ public:
             void                setArgV0(const char* txt);
 
             void                spawnPooledThread(bool isMain);
-            
+
+            // Each thread's command buffers start at 'initial' bytes; the read
+            // buffer doubles (up to 'max') when reads come back full, and
+            // halves again once it has been mostly idle for a while.  Threads
+            // that already exist keep their initial size.
+            status_t            setIpcBufferSize(size_t initial, size_t max);
+            IpcBufferStats      getIpcBufferStats() const;
+
+            // Placement of the threads serving binder calls, applied as each
+            // joins the pool: the main looper as well as spawned threads.
+            // With roundRobin, each thread gets the next single CPU of 'cpus'
+            // rather than the whole set.
+            status_t            setThreadPoolAffinity(const cpu_set_t& cpus,
+                                                      bool roundRobin = false);
+            // SCHED_OTHER, SCHED_BATCH and SCHED_IDLE take a nice value as
+            // priority, SCHED_FIFO and SCHED_RR a real-time priority.
+            status_t            setThreadPoolSchedPolicy(int policy, int priority);
+            // Keep pool threads on the CPUs of NUMA node 'node' (within any
+            // affinity set above) and prefer its memory; -1 to stop.
+            status_t            setThreadPoolNumaNode(int node);
+
 private:
     friend class IPCThreadState;
     
@@ -79,20 +130,40 @@ private:
                                 ProcessState(const ProcessState& o);
             ProcessState&       operator=(const ProcessState& o);
             
+            // The handle table is read without mLock: each slot is only
+            // ever changed with an atomic store or compare-and-swap, and
+            // expungeHandle() waits for readers that may still be looking
+            // at the proxy it removes.
             struct handle_entry {
-                IBinder* binder;
-                RefBase::weakref_type* refs;
+                IBinder* volatile binder;
             };
-            
-            handle_entry*       lookupHandleLocked(int32_t handle);
+
+            enum {
+                // Bucket n of the handle table holds FIRST_HANDLE_BUCKET<<n
+                // slots, so a fixed directory covers every positive handle.
+                FIRST_HANDLE_BUCKET_SHIFT = 5,
+                FIRST_HANDLE_BUCKET = 1 << FIRST_HANDLE_BUCKET_SHIFT,
+                HANDLE_BUCKETS = 32 - FIRST_HANDLE_BUCKET_SHIFT
+            };
+
+            void                applyThreadPoolPolicy();
+            bool                growMapping(int32_t seenRegions);
+
+            handle_entry*       lookupHandle(int32_t handle, bool create);
+            IBinder*            attemptIncWeakHandle(handle_entry* e);
+            void                waitForHandleReaders(IBinder* binder);
 
             int                 mDriverFD;
+            int                 mDriverFeatures;    // BINDER_GET_FEATURES
             void*               mVMStart;
+            BinderMmapConfig    mMmapConfig;
+            size_t              mVMSize;            // all mappings, under mLock
+    volatile int32_t            mVMRegions;
             
+            handle_entry* volatile mHandleBuckets[HANDLE_BUCKETS];
+
     mutable Mutex               mLock;  // protects everything below.
             
-            Vector<handle_entry>mHandleToObject;
-
             bool                mManagesContexts;
             context_check_func  mBinderContextCheckFunc;
             void*               mBinderContextUserData;
@@ -104,6 +175,23 @@ private:
             String8             mRootDir;
             bool                mThreadPoolStarted;
     volatile int32_t            mThreadPoolSeq;
+
+            size_t              mIpcBufferInitial;
+            size_t              mIpcBufferMax;
+    volatile int32_t            mIpcReads;
+    volatile int32_t            mIpcCommands;
+    volatile int32_t            mIpcGrows;
+    volatile int32_t            mIpcShrinks;
+
+            // Thread pool placement, under mLock
+            bool                mPoolAffinitySet;
+            bool                mPoolRoundRobin;
+            cpu_set_t           mPoolCpus;
+            int                 mPoolPolicy;        // -1: leave alone
+            int                 mPoolPriority;
+            int                 mPoolNumaNode;      // -1: none
+            cpu_set_t           mPoolNumaCpus;
+    volatile int32_t            mPoolCpuSeq;
 };
     
 }; // namespace android
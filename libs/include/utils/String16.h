@@ -21,6 +21,8 @@
 #include <utils/SharedBuffer.h>
 #include <utils/Unicode.h>
 
+#include <stddef.h>
+
 // ---------------------------------------------------------------------------
 
 extern "C" {
@@ -56,6 +58,7 @@ public:
     inline  const char16_t*     string() const;
     inline  size_t              size() const;
     
+    // Returns NULL for short strings, which are stored inline.
     inline  const SharedBuffer* sharedBuffer() const;
     
             void                setTo(const String16& other);
@@ -90,6 +93,14 @@ public:
 
             status_t            remove(size_t len, size_t begin=0);
 
+            // Returns the canonical copy of this string from a process-wide
+            // table, adding it if needed.  Interned strings live until the
+            // library is unloaded; use this for long-lived keys such as
+            // interface descriptors and permission names.  Two interned
+            // strings compare equal only if they share the same buffer.
+            String16            intern() const;
+    inline  bool                isInterned() const;
+
     inline  int                 compare(const String16& other) const;
 
     inline  bool                operator<(const String16& other) const;
@@ -109,7 +120,23 @@ public:
     inline                      operator const char16_t*() const;
     
 private:
+            enum {
+                // Strings up to this many characters are kept inline.
+                INLINE_CAPACITY = 15,
+                FLAG_INTERNED = 0x1
+            };
+
+    inline  bool                isInline() const;
+    inline  bool                isSameString(const String16& other) const;
+            void                initFromUTF8(const char* u8str, size_t u8len);
+            void                releaseBuffer();
+            char16_t*           editResize(size_t len);
+            char16_t*           edit();
+
             const char16_t*     mString;
+            uint32_t            mInlineSize;
+            uint32_t            mFlags;
+            char16_t            mInline[INLINE_CAPACITY+1];
 };
 
 TextOutput& operator<<(TextOutput& to, const String16& val);
@@ -134,14 +161,33 @@ inline const char16_t* String16::string() const
 
 inline size_t String16::size() const
 {
+    if (isInline()) return mInlineSize;
     return SharedBuffer::sizeFromData(mString)/sizeof(char16_t)-1;
 }
 
 inline const SharedBuffer* String16::sharedBuffer() const
 {
+    if (isInline()) return NULL;
     return SharedBuffer::bufferFromData(mString);
 }
 
+inline bool String16::isInterned() const
+{
+    return (mFlags & FLAG_INTERNED) != 0;
+}
+
+inline bool String16::isInline() const
+{
+    return mString == mInline;
+}
+
+inline bool String16::isSameString(const String16& other) const
+{
+    if (mString == other.mString) return true;
+    if (mFlags & other.mFlags & FLAG_INTERNED) return false;
+    return strzcmp16(mString, size(), other.mString, other.size()) == 0;
+}
+
 inline String16& String16::operator=(const String16& other)
 {
     setTo(other);
@@ -163,6 +209,7 @@ inline String16 String16::operator+(const String16& other) const
 
 inline int String16::compare(const String16& other) const
 {
+    if (mString == other.mString) return 0;
     return strzcmp16(mString, size(), other.mString, other.size());
 }
 
@@ -178,12 +225,12 @@ inline bool String16::operator<=(const String16& other) const
 
 inline bool String16::operator==(const String16& other) const
 {
-    return strzcmp16(mString, size(), other.mString, other.size()) == 0;
+    return isSameString(other);
 }
 
 inline bool String16::operator!=(const String16& other) const
 {
-    return strzcmp16(mString, size(), other.mString, other.size()) != 0;
+    return !isSameString(other);
 }
 
 inline bool String16::operator>=(const String16& other) const
@@ -59,6 +59,7 @@ public:
     inline  size_t              bytes() const;
     inline  bool                isEmpty() const;
     
+    // Returns NULL for short strings, which are stored inline.
     inline  const SharedBuffer* sharedBuffer() const;
     
             void                clear();
@@ -125,6 +126,11 @@ public:
             void                toUpper();
             void                toUpper(size_t start, size_t numChars);
 
+            // Returns the canonical copy of this string from a process-wide
+            // table, adding it if needed.  See String16::intern().
+            String8             intern() const;
+    inline  bool                isInterned() const;
+
     /*
      * These methods operate on the string as if it were a path name.
      */
@@ -213,10 +219,26 @@ public:
     String8& convertToResPath();
 
 private:
+            enum {
+                // Strings up to this many bytes are kept inline.
+                INLINE_CAPACITY = 31,
+                FLAG_INTERNED = 0x1
+            };
+
+    inline  bool                isInline() const;
+    inline  bool                isSameString(const String8& other) const;
+            char*               allocStorage(size_t len);
+            void                adoptStorage(char* str, size_t len);
+            void                releaseBuffer();
+            char*               editResize(size_t len);
+
             status_t            real_append(const char* other, size_t numChars);
             char*               find_extension(void) const;
 
-            const char* mString;
+            const char*         mString;
+            uint32_t            mInlineSize;
+            uint32_t            mFlags;
+            char                mInline[INLINE_CAPACITY+1];
 };
 
 TextOutput& operator<<(TextOutput& to, const String16& val);
@@ -245,6 +267,7 @@ inline const char* String8::string() const
 
 inline size_t String8::length() const
 {
+    if (isInline()) return mInlineSize;
     return SharedBuffer::sizeFromData(mString)-1;
 }
 
@@ -260,14 +283,32 @@ inline bool String8::isEmpty() const
 
 inline size_t String8::bytes() const
 {
-    return SharedBuffer::sizeFromData(mString)-1;
+    return length();
 }
 
 inline const SharedBuffer* String8::sharedBuffer() const
 {
+    if (isInline()) return NULL;
     return SharedBuffer::bufferFromData(mString);
 }
 
+inline bool String8::isInterned() const
+{
+    return (mFlags & FLAG_INTERNED) != 0;
+}
+
+inline bool String8::isInline() const
+{
+    return mString == mInline;
+}
+
+inline bool String8::isSameString(const String8& other) const
+{
+    if (mString == other.mString) return true;
+    if (mFlags & other.mFlags & FLAG_INTERNED) return false;
+    return strcmp(mString, other.mString) == 0;
+}
+
 inline String8& String8::operator=(const String8& other)
 {
     setTo(other);
@@ -308,6 +349,7 @@ inline String8 String8::operator+(const char* other) const
 
 inline int String8::compare(const String8& other) const
 {
+    if (mString == other.mString) return 0;
     return strcmp(mString, other.mString);
 }
 
@@ -323,12 +365,12 @@ inline bool String8::operator<=(const String8& other) const
 
 inline bool String8::operator==(const String8& other) const
 {
-    return strcmp(mString, other.mString) == 0;
+    return isSameString(other);
 }
 
 inline bool String8::operator!=(const String8& other) const
 {
-    return strcmp(mString, other.mString) != 0;
+    return !isSameString(other);
 }
 
 inline bool String8::operator>=(const String8& other) const
@@ -18,6 +18,7 @@
 
 #include <utils/Debug.h>
 #include <utils/Log.h>
+#include <utils/SortedVector.h>
 #include <utils/Unicode.h>
 #include <utils/String8.h>
 #include <utils/TextOutput.h>
@@ -32,145 +33,204 @@
 
 namespace android {
 
-static SharedBuffer* gEmptyStringBuf = NULL;
-static char16_t* gEmptyString = NULL;
-
-static inline char16_t* getEmptyString()
-{
-    gEmptyStringBuf->acquire();
-   return gEmptyString;
-}
+// Process-wide table of interned strings, see String16::intern().
+static Mutex* gInternLock = NULL;
+static SortedVector<String16>* gInternTable = NULL;
 
 void initialize_string16()
 {
-    SharedBuffer* buf = SharedBuffer::alloc(sizeof(char16_t));
-    char16_t* str = (char16_t*)buf->data();
-    *str = 0;
-    gEmptyStringBuf = buf;
-    gEmptyString = str;
+    gInternLock = new Mutex();
+    gInternTable = new SortedVector<String16>();
 }
 
 void terminate_string16()
 {
-    SharedBuffer::bufferFromData(gEmptyString)->release();
-    gEmptyStringBuf = NULL;
-    gEmptyString = NULL;
+    delete gInternTable;
+    delete gInternLock;
+    gInternTable = NULL;
+    gInternLock = NULL;
 }
 
 // ---------------------------------------------------------------------------
 
-static char16_t* allocFromUTF8(const char* u8str, size_t u8len)
+void String16::initFromUTF8(const char* u8str, size_t u8len)
 {
-    if (u8len == 0) return getEmptyString();
+    mString = mInline;
+    mInlineSize = 0;
+    mFlags = 0;
+    mInline[0] = 0;
 
-    const uint8_t* u8cur = (const uint8_t*) u8str;
+    if (u8len == 0) return;
 
-    const ssize_t u16len = utf8_to_utf16_length(u8cur, u8len);
-    if (u16len < 0) {
-        return getEmptyString();
-    }
-
-    const uint8_t* const u8end = u8cur + u8len;
+    const ssize_t u16len = utf8_to_utf16_length((const uint8_t*) u8str, u8len);
+    if (u16len < 0) return;
 
-    SharedBuffer* buf = SharedBuffer::alloc(sizeof(char16_t)*(u16len+1));
-    if (buf) {
-        u8cur = (const uint8_t*) u8str;
-        char16_t* u16str = (char16_t*)buf->data();
-
-        utf8_to_utf16(u8cur, u8len, u16str);
+    char16_t* u16str = editResize(u16len);
+    if (u16str) {
+        utf8_to_utf16((const uint8_t*) u8str, u8len, u16str);
 
         //printf("Created UTF-16 string from UTF-8 \"%s\":", in);
         //printHexData(1, str, buf->size(), 16, 1);
         //printf("\n");
-        
-        return u16str;
     }
+}
 
-    return getEmptyString();
+void String16::releaseBuffer()
+{
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+        mString = mInline;
+    }
+    mInlineSize = 0;
+    mFlags = 0;
+    mInline[0] = 0;
+}
+
+// Makes room for len characters plus the terminator, keeping as much of
+// the current contents as fits, and returns the writable storage.  Short
+// strings move into (or stay in) the inline buffer.
+char16_t* String16::editResize(size_t len)
+{
+    const size_t myLen = size();
+    mFlags = 0;
+
+    if (len <= INLINE_CAPACITY) {
+        if (!isInline()) {
+            const char16_t* str = mString;
+            memcpy(mInline, str, (myLen < len ? myLen : len)*sizeof(char16_t));
+            SharedBuffer::bufferFromData(str)->release();
+            mString = mInline;
+        }
+        mInlineSize = len;
+        return mInline;
+    }
+
+    if (isInline()) {
+        SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
+        if (!buf) {
+            return NULL;
+        }
+        char16_t* str = (char16_t*)buf->data();
+        memcpy(str, mInline, myLen*sizeof(char16_t));
+        mString = str;
+        return str;
+    }
+
+    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
+        ->editResize((len+1)*sizeof(char16_t));
+    if (!buf) {
+        return NULL;
+    }
+    char16_t* str = (char16_t*)buf->data();
+    mString = str;
+    return str;
+}
+
+char16_t* String16::edit()
+{
+    mFlags = 0;
+    if (isInline()) {
+        return mInline;
+    }
+    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)->edit();
+    if (!buf) {
+        return NULL;
+    }
+    char16_t* str = (char16_t*)buf->data();
+    mString = str;
+    return str;
 }
 
 // ---------------------------------------------------------------------------
 
 String16::String16()
-    : mString(getEmptyString())
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
 }
 
 String16::String16(const String16& o)
-    : mString(o.mString)
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
-    SharedBuffer::bufferFromData(mString)->acquire();
+    mInline[0] = 0;
+    setTo(o);
 }
 
 String16::String16(const String16& o, size_t len, size_t begin)
-    : mString(getEmptyString())
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
     setTo(o, len, begin);
 }
 
 String16::String16(const char16_t* o)
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
-    size_t len = strlen16(o);
-    SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
-    LOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
-        strcpy16(str, o);
-        mString = str;
-        return;
-    }
-    
-    mString = getEmptyString();
+    mInline[0] = 0;
+    setTo(o, strlen16(o));
 }
 
 String16::String16(const char16_t* o, size_t len)
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
-    SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
-    LOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
-        memcpy(str, o, len*sizeof(char16_t));
-        str[len] = 0;
-        mString = str;
-        return;
-    }
-    
-    mString = getEmptyString();
+    mInline[0] = 0;
+    setTo(o, len);
 }
 
 String16::String16(const String8& o)
-    : mString(allocFromUTF8(o.string(), o.size()))
 {
+    initFromUTF8(o.string(), o.size());
 }
 
 String16::String16(const char* o)
-    : mString(allocFromUTF8(o, strlen(o)))
 {
+    initFromUTF8(o, strlen(o));
 }
 
 String16::String16(const char* o, size_t len)
-    : mString(allocFromUTF8(o, len))
 {
+    initFromUTF8(o, len);
 }
 
 String16::~String16()
 {
-    SharedBuffer::bufferFromData(mString)->release();
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+    }
 }
 
 void String16::setTo(const String16& other)
 {
+    if (&other == this) {
+        return;
+    }
+    if (other.isInline()) {
+        releaseBuffer();
+        memcpy(mInline, other.mInline, (other.mInlineSize+1)*sizeof(char16_t));
+        mInlineSize = other.mInlineSize;
+        return;
+    }
     SharedBuffer::bufferFromData(other.mString)->acquire();
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseBuffer();
     mString = other.mString;
+    mFlags = other.mFlags;
 }
 
 status_t String16::setTo(const String16& other, size_t len, size_t begin)
 {
     const size_t N = other.size();
     if (begin >= N) {
-        SharedBuffer::bufferFromData(mString)->release();
-        mString = getEmptyString();
+        releaseBuffer();
         return NO_ERROR;
     }
     if ((begin+len) > N) len = N-begin;
@@ -193,12 +253,25 @@ status_t String16::setTo(const char16_t* other)
 
 status_t String16::setTo(const char16_t* other, size_t len)
 {
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize((len+1)*sizeof(char16_t));
+    if (len <= INLINE_CAPACITY) {
+        // Copy before releasing: other may point into our own buffer.
+        memmove(mInline, other, len*sizeof(char16_t));
+        mInline[len] = 0;
+        if (!isInline()) {
+            SharedBuffer::bufferFromData(mString)->release();
+            mString = mInline;
+        }
+        mInlineSize = len;
+        mFlags = 0;
+        return NO_ERROR;
+    }
+
+    SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
     if (buf) {
         char16_t* str = (char16_t*)buf->data();
-        memmove(str, other, len*sizeof(char16_t));
+        memcpy(str, other, len*sizeof(char16_t));
         str[len] = 0;
+        releaseBuffer();
         mString = str;
         return NO_ERROR;
     }
@@ -216,12 +289,10 @@ status_t String16::append(const String16& other)
         return NO_ERROR;
     }
     
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize((myLen+otherLen+1)*sizeof(char16_t));
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
-        memcpy(str+myLen, other, (otherLen+1)*sizeof(char16_t));
-        mString = str;
+    char16_t* str = editResize(myLen+otherLen);
+    if (str) {
+        memcpy(str+myLen, other, otherLen*sizeof(char16_t));
+        str[myLen+otherLen] = 0;
         return NO_ERROR;
     }
     return NO_MEMORY;
@@ -237,13 +308,10 @@ status_t String16::append(const char16_t* chrs, size_t otherLen)
         return NO_ERROR;
     }
     
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize((myLen+otherLen+1)*sizeof(char16_t));
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
+    char16_t* str = editResize(myLen+otherLen);
+    if (str) {
         memcpy(str+myLen, chrs, otherLen*sizeof(char16_t));
         str[myLen+otherLen] = 0;
-        mString = str;
         return NO_ERROR;
     }
     return NO_MEMORY;
@@ -272,16 +340,13 @@ status_t String16::insert(size_t pos, const char16_t* chrs, size_t len)
            len, myLen, String8(chrs, len).string());
     #endif
 
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize((myLen+len+1)*sizeof(char16_t));
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
+    char16_t* str = editResize(myLen+len);
+    if (str) {
         if (pos < myLen) {
             memmove(str+pos+len, str+pos, (myLen-pos)*sizeof(char16_t));
         }
         memcpy(str+pos, chrs, len*sizeof(char16_t));
         str[myLen+len] = 0;
-        mString = str;
         #if 0
         printf("Result (%d chrs): %s\n", size(), String8(*this).string());
         #endif
@@ -341,12 +406,11 @@ status_t String16::makeLower()
         const char16_t v = str[i];
         if (v >= 'A' && v <= 'Z') {
             if (!edit) {
-                SharedBuffer* buf = SharedBuffer::bufferFromData(mString)->edit();
-                if (!buf) {
+                edit = this->edit();
+                if (!edit) {
                     return NO_MEMORY;
                 }
-                edit = (char16_t*)buf->data();
-                mString = str = edit;
+                str = edit;
             }
             edit[i] = tolower((char)v);
         }
@@ -362,12 +426,11 @@ status_t String16::replaceAll(char16_t replaceThis, char16_t withThis)
     for (size_t i=0; i<N; i++) {
         if (str[i] == replaceThis) {
             if (!edit) {
-                SharedBuffer* buf = SharedBuffer::bufferFromData(mString)->edit();
-                if (!buf) {
+                edit = this->edit();
+                if (!edit) {
                     return NO_MEMORY;
                 }
-                edit = (char16_t*)buf->data();
-                mString = str = edit;
+                str = edit;
             }
             edit[i] = withThis;
         }
@@ -379,8 +442,7 @@ status_t String16::remove(size_t len, size_t begin)
 {
     const size_t N = size();
     if (begin >= N) {
-        SharedBuffer::bufferFromData(mString)->release();
-        mString = getEmptyString();
+        releaseBuffer();
         return NO_ERROR;
     }
     if ((begin+len) > N) len = N-begin;
@@ -389,26 +451,49 @@ status_t String16::remove(size_t len, size_t begin)
     }
 
     if (begin > 0) {
-        SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-            ->editResize((N+1)*sizeof(char16_t));
-        if (!buf) {
+        char16_t* str = edit();
+        if (!str) {
             return NO_MEMORY;
         }
-        char16_t* str = (char16_t*)buf->data();
         memmove(str, str+begin, (N-begin+1)*sizeof(char16_t));
-        mString = str;
     }
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize((len+1)*sizeof(char16_t));
-    if (buf) {
-        char16_t* str = (char16_t*)buf->data();
+    char16_t* str = editResize(len);
+    if (str) {
         str[len] = 0;
-        mString = str;
         return NO_ERROR;
     }
     return NO_MEMORY;
 }
 
+String16 String16::intern() const
+{
+    if (isInterned() || gInternTable == NULL) {
+        return *this;
+    }
+
+    AutoMutex _l(*gInternLock);
+    ssize_t index = gInternTable->indexOf(*this);
+    if (index >= 0) {
+        return gInternTable->itemAt(index);
+    }
+
+    // Interned strings always live in a SharedBuffer, even short ones, so
+    // that every copy of them shares the same pointer.
+    const size_t len = size();
+    SharedBuffer* buf = SharedBuffer::alloc((len+1)*sizeof(char16_t));
+    if (!buf) {
+        return *this;
+    }
+    char16_t* str = (char16_t*)buf->data();
+    memcpy(str, mString, (len+1)*sizeof(char16_t));
+
+    String16 interned;
+    interned.mString = str;
+    interned.mFlags = FLAG_INTERNED;
+    gInternTable->add(interned);
+    return interned;
+}
+
 TextOutput& operator<<(TextOutput& to, const String16& val)
 {
     to << String8(val).string();
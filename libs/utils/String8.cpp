@@ -19,6 +19,7 @@
 #include <utils/Log.h>
 #include <utils/Unicode.h>
 #include <utils/SharedBuffer.h>
+#include <utils/SortedVector.h>
 #include <utils/String16.h>
 #include <utils/TextOutput.h>
 #include <utils/threads.h>
@@ -42,18 +43,13 @@ namespace android {
 // to OS_PATH_SEPARATOR.
 #define RES_PATH_SEPARATOR '/'
 
-static SharedBuffer* gEmptyStringBuf = NULL;
-static char* gEmptyString = NULL;
+// Process-wide table of interned strings, see String8::intern().
+static Mutex* gInternLock = NULL;
+static SortedVector<String8>* gInternTable = NULL;
 
 extern int gDarwinCantLoadAllObjects;
 int gDarwinIsReallyAnnoying;
 
-static inline char* getEmptyString()
-{
-    gEmptyStringBuf->acquire();
-    return gEmptyString;
-}
-
 void initialize_string8()
 {
     // HACK: This dummy dependency forces linking libutils Static.cpp,
@@ -62,139 +58,180 @@ void initialize_string8()
     // including static linking on any platform.
     gDarwinIsReallyAnnoying = gDarwinCantLoadAllObjects;
 
-    SharedBuffer* buf = SharedBuffer::alloc(1);
-    char* str = (char*)buf->data();
-    *str = 0;
-    gEmptyStringBuf = buf;
-    gEmptyString = str;
+    gInternLock = new Mutex();
+    gInternTable = new SortedVector<String8>();
 }
 
 void terminate_string8()
 {
-    SharedBuffer::bufferFromData(gEmptyString)->release();
-    gEmptyStringBuf = NULL;
-    gEmptyString = NULL;
+    delete gInternTable;
+    delete gInternLock;
+    gInternTable = NULL;
+    gInternLock = NULL;
 }
 
 // ---------------------------------------------------------------------------
 
-static char* allocFromUTF8(const char* in, size_t len)
+// Returns storage for len bytes plus the terminator without touching the
+// current contents: the inline buffer for short strings, otherwise a new
+// SharedBuffer.  Hand the result to adoptStorage() once it is filled in.
+char* String8::allocStorage(size_t len)
 {
-    if (len > 0) {
-        SharedBuffer* buf = SharedBuffer::alloc(len+1);
-        LOG_ASSERT(buf, "Unable to allocate shared buffer");
-        if (buf) {
-            char* str = (char*)buf->data();
-            memcpy(str, in, len);
-            str[len] = 0;
-            return str;
-        }
-        return NULL;
+    if (len <= INLINE_CAPACITY) {
+        return mInline;
     }
-
-    return getEmptyString();
+    SharedBuffer* buf = SharedBuffer::alloc(len+1);
+    LOG_ASSERT(buf, "Unable to allocate shared buffer");
+    return buf ? (char*)buf->data() : NULL;
 }
 
-static char* allocFromUTF16(const char16_t* in, size_t len)
+void String8::adoptStorage(char* str, size_t len)
 {
-    if (len == 0) return getEmptyString();
-
-    const ssize_t bytes = utf16_to_utf8_length(in, len);
-    if (bytes < 0) {
-        return getEmptyString();
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
     }
-
-    SharedBuffer* buf = SharedBuffer::alloc(bytes+1);
-    LOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (!buf) {
-        return getEmptyString();
-    }
-
-    char* str = (char*)buf->data();
-    utf16_to_utf8(in, len, str);
-    return str;
+    mString = str;
+    mInlineSize = (str == mInline) ? len : 0;
+    mFlags = 0;
 }
 
-static char* allocFromUTF32(const char32_t* in, size_t len)
+void String8::releaseBuffer()
 {
-    if (len == 0) {
-        return getEmptyString();
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+        mString = mInline;
     }
-
-    const ssize_t bytes = utf32_to_utf8_length(in, len);
-    if (bytes < 0) {
-        return getEmptyString();
-    }
-
-    SharedBuffer* buf = SharedBuffer::alloc(bytes+1);
-    LOG_ASSERT(buf, "Unable to allocate shared buffer");
-    if (!buf) {
-        return getEmptyString();
+    mInlineSize = 0;
+    mFlags = 0;
+    mInline[0] = 0;
+}
+
+// Makes room for len bytes plus the terminator, keeping as much of the
+// current contents as fits, and returns the writable storage.  The
+// result is always terminated at len.
+char* String8::editResize(size_t len)
+{
+    const size_t myLen = length();
+    char* str;
+    mFlags = 0;
+
+    if (len <= INLINE_CAPACITY) {
+        if (!isInline()) {
+            const char* old = mString;
+            memcpy(mInline, old, myLen < len ? myLen : len);
+            SharedBuffer::bufferFromData(old)->release();
+            mString = mInline;
+        }
+        mInlineSize = len;
+        str = mInline;
+    } else if (isInline()) {
+        SharedBuffer* buf = SharedBuffer::alloc(len+1);
+        if (!buf) {
+            return NULL;
+        }
+        str = (char*)buf->data();
+        memcpy(str, mInline, myLen);
+        mString = str;
+    } else {
+        SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
+            ->editResize(len+1);
+        if (!buf) {
+            return NULL;
+        }
+        str = (char*)buf->data();
+        mString = str;
     }
-
-    char* str = (char*) buf->data();
-    utf32_to_utf8(in, len, str);
-
+    str[len] = 0;
     return str;
 }
 
 // ---------------------------------------------------------------------------
 
 String8::String8()
-    : mString(getEmptyString())
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
 }
 
 String8::String8(const String8& o)
-    : mString(o.mString)
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
-    SharedBuffer::bufferFromData(mString)->acquire();
+    mInline[0] = 0;
+    setTo(o);
 }
 
 String8::String8(const char* o)
-    : mString(allocFromUTF8(o, strlen(o)))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
-    if (mString == NULL) {
-        mString = getEmptyString();
-    }
+    mInline[0] = 0;
+    setTo(o, strlen(o));
 }
 
 String8::String8(const char* o, size_t len)
-    : mString(allocFromUTF8(o, len))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
-    if (mString == NULL) {
-        mString = getEmptyString();
-    }
+    mInline[0] = 0;
+    setTo(o, len);
 }
 
 String8::String8(const String16& o)
-    : mString(allocFromUTF16(o.string(), o.size()))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
+    setTo(o.string(), o.size());
 }
 
 String8::String8(const char16_t* o)
-    : mString(allocFromUTF16(o, strlen16(o)))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
+    setTo(o, strlen16(o));
 }
 
 String8::String8(const char16_t* o, size_t len)
-    : mString(allocFromUTF16(o, len))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
+    setTo(o, len);
 }
 
 String8::String8(const char32_t* o)
-    : mString(allocFromUTF32(o, strlen32(o)))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
+    setTo(o, strlen32(o));
 }
 
 String8::String8(const char32_t* o, size_t len)
-    : mString(allocFromUTF32(o, len))
+    : mString(mInline)
+    , mInlineSize(0)
+    , mFlags(0)
 {
+    mInline[0] = 0;
+    setTo(o, len);
 }
 
 String8::~String8()
 {
-    SharedBuffer::bufferFromData(mString)->release();
+    if (!isInline()) {
+        SharedBuffer::bufferFromData(mString)->release();
+    }
 }
 
 String8 String8::format(const char* fmt, ...)
@@ -216,59 +253,79 @@ String8 String8::formatV(const char* fmt, va_list args)
 }
 
 void String8::clear() {
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = getEmptyString();
+    releaseBuffer();
 }
 
 void String8::setTo(const String8& other)
 {
+    if (&other == this) {
+        return;
+    }
+    if (other.isInline()) {
+        releaseBuffer();
+        memcpy(mInline, other.mInline, other.mInlineSize+1);
+        mInlineSize = other.mInlineSize;
+        return;
+    }
     SharedBuffer::bufferFromData(other.mString)->acquire();
-    SharedBuffer::bufferFromData(mString)->release();
+    releaseBuffer();
     mString = other.mString;
+    mFlags = other.mFlags;
 }
 
 status_t String8::setTo(const char* other)
 {
-    const char *newString = allocFromUTF8(other, strlen(other));
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
-
-    mString = getEmptyString();
-    return NO_MEMORY;
+    return setTo(other, strlen(other));
 }
 
 status_t String8::setTo(const char* other, size_t len)
 {
-    const char *newString = allocFromUTF8(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
-
-    mString = getEmptyString();
-    return NO_MEMORY;
+    char* str = allocStorage(len);
+    if (!str) {
+        releaseBuffer();
+        return NO_MEMORY;
+    }
+    // other may point into our own inline buffer.
+    memmove(str, other, len);
+    str[len] = 0;
+    adoptStorage(str, len);
+    return NO_ERROR;
 }
 
 status_t String8::setTo(const char16_t* other, size_t len)
 {
-    const char *newString = allocFromUTF16(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
+    const ssize_t bytes = len > 0 ? utf16_to_utf8_length(other, len) : 0;
+    if (bytes <= 0) {
+        releaseBuffer();
+        return NO_ERROR;
+    }
 
-    mString = getEmptyString();
-    return NO_MEMORY;
+    char* str = allocStorage(bytes);
+    if (!str) {
+        releaseBuffer();
+        return NO_MEMORY;
+    }
+    utf16_to_utf8(other, len, str);
+    adoptStorage(str, bytes);
+    return NO_ERROR;
 }
 
 status_t String8::setTo(const char32_t* other, size_t len)
 {
-    const char *newString = allocFromUTF32(other, len);
-    SharedBuffer::bufferFromData(mString)->release();
-    mString = newString;
-    if (mString) return NO_ERROR;
+    const ssize_t bytes = len > 0 ? utf32_to_utf8_length(other, len) : 0;
+    if (bytes <= 0) {
+        releaseBuffer();
+        return NO_ERROR;
+    }
 
-    mString = getEmptyString();
-    return NO_MEMORY;
+    char* str = allocStorage(bytes);
+    if (!str) {
+        releaseBuffer();
+        return NO_MEMORY;
+    }
+    utf32_to_utf8(other, len, str);
+    adoptStorage(str, bytes);
+    return NO_ERROR;
 }
 
 status_t String8::append(const String8& other)
@@ -331,11 +388,8 @@ status_t String8::real_append(const char* other, size_t otherLen)
 {
     const size_t myLen = bytes();
     
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize(myLen+otherLen+1);
-    if (buf) {
-        char* str = (char*)buf->data();
-        mString = str;
+    char* str = editResize(myLen+otherLen);
+    if (str) {
         str += myLen;
         memcpy(str, other, otherLen);
         str[otherLen] = '\0';
@@ -346,14 +400,7 @@ status_t String8::real_append(const char* other, size_t otherLen)
 
 char* String8::lockBuffer(size_t size)
 {
-    SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-        ->editResize(size+1);
-    if (buf) {
-        char* str = (char*)buf->data();
-        mString = str;
-        return str;
-    }
-    return NULL;
+    return editResize(size);
 }
 
 void String8::unlockBuffer()
@@ -364,15 +411,11 @@ void String8::unlockBuffer()
 status_t String8::unlockBuffer(size_t size)
 {
     if (size != this->size()) {
-        SharedBuffer* buf = SharedBuffer::bufferFromData(mString)
-            ->editResize(size+1);
-        if (! buf) {
+        char* str = editResize(size);
+        if (! str) {
             return NO_MEMORY;
         }
-
-        char* str = (char*)buf->data();
         str[size] = 0;
-        mString = str;
     }
 
     return NO_ERROR;
@@ -452,6 +495,35 @@ void String8::getUtf32(char32_t* dst) const
     utf8_to_utf32(mString, length(), dst);
 }
 
+String8 String8::intern() const
+{
+    if (isInterned() || gInternTable == NULL) {
+        return *this;
+    }
+
+    AutoMutex _l(*gInternLock);
+    ssize_t index = gInternTable->indexOf(*this);
+    if (index >= 0) {
+        return gInternTable->itemAt(index);
+    }
+
+    // Interned strings always live in a SharedBuffer, even short ones, so
+    // that every copy of them shares the same pointer.
+    const size_t len = length();
+    SharedBuffer* buf = SharedBuffer::alloc(len+1);
+    if (!buf) {
+        return *this;
+    }
+    char* str = (char*)buf->data();
+    memcpy(str, mString, len+1);
+
+    String8 interned;
+    interned.mString = str;
+    interned.mFlags = FLAG_INTERNED;
+    gInternTable->add(interned);
+    return interned;
+}
+
 TextOutput& operator<<(TextOutput& to, const String8& val)
 {
     to << val.string();
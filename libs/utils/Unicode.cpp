@@ -39,6 +39,14 @@
 # include <netinet/in.h>
 #endif
 
+// The transcoders below hand runs of ASCII (and, when measuring UTF-16,
+// runs without surrogates) to SSE2 or AVX2 kernels, picked at runtime.
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) \
+        && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define UNICODE_X86_SIMD 1
+# include <immintrin.h>
+#endif
+
 extern "C" {
 
 static const char32_t kByteMask = 0x000000BF;
@@ -68,6 +76,259 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// Vectorised kernels
+// --------------------------------------------------------------------------
+
+/*
+ * Each kernel handles the longest prefix of its input that it can, and
+ * returns the number of input units consumed; the callers deal with
+ * whatever stopped it one code point at a time.
+ *
+ *   ascii_prefix8:   leading bytes < 0x80.
+ *   ascii8_to_16:    as above, widening them into dst.
+ *   ascii16_to_8:    leading units < 0x80, narrowing them into dst.
+ *   bmp_utf8_length: leading non-surrogate units, adding their UTF-8
+ *                    length to *ioLen.
+ */
+struct unicode_kernels {
+    size_t (*ascii_prefix8)(const uint8_t* src, size_t len);
+    size_t (*ascii8_to_16)(const uint8_t* src, size_t len, char16_t* dst);
+    size_t (*ascii16_to_8)(const char16_t* src, size_t len, char* dst);
+    size_t (*bmp_utf8_length)(const char16_t* src, size_t len, size_t* ioLen);
+};
+
+static inline bool is_surrogate(char16_t ch)
+{
+    return (ch & 0xF800) == 0xD800;
+}
+
+static size_t ascii_prefix8_scalar(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    while (i < len && src[i] < 0x80) i++;
+    return i;
+}
+
+static size_t ascii8_to_16_scalar(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+    for (; i < len && src[i] < 0x80; i++) {
+        dst[i] = src[i];
+    }
+    return i;
+}
+
+static size_t ascii16_to_8_scalar(const char16_t* src, size_t len, char* dst)
+{
+    size_t i = 0;
+    for (; i < len && src[i] < 0x80; i++) {
+        dst[i] = (char) src[i];
+    }
+    return i;
+}
+
+static size_t bmp_utf8_length_scalar(const char16_t* src, size_t len, size_t* ioLen)
+{
+    size_t i = 0;
+    size_t bytes = 0;
+    for (; i < len && !is_surrogate(src[i]); i++) {
+        bytes += src[i] < 0x80 ? 1 : (src[i] < 0x800 ? 2 : 3);
+    }
+    *ioLen += bytes;
+    return i;
+}
+
+static const unicode_kernels kScalarKernels = {
+    ascii_prefix8_scalar,
+    ascii8_to_16_scalar,
+    ascii16_to_8_scalar,
+    bmp_utf8_length_scalar,
+};
+
+#ifdef UNICODE_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t ascii_prefix8_sse2(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const int mask = _mm_movemask_epi8(
+                _mm_loadu_si128((const __m128i*)(src + i)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + ascii_prefix8_scalar(src + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t ascii8_to_16_sse2(const uint8_t* src, size_t len, char16_t* dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return i + ascii8_to_16_scalar(src + i, len - i, dst + i);
+}
+
+__attribute__((target("sse2")))
+static size_t ascii16_to_8_sse2(const char16_t* src, size_t len, char* dst)
+{
+    const __m128i nonAscii = _mm_set1_epi16((short) 0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        const __m128i high = _mm_and_si128(_mm_or_si128(a, b), nonAscii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+    }
+    return i + ascii16_to_8_scalar(src + i, len - i, dst + i);
+}
+
+__attribute__((target("sse2")))
+static size_t bmp_utf8_length_sse2(const char16_t* src, size_t len, size_t* ioLen)
+{
+    const __m128i surrogateMask = _mm_set1_epi16((short) 0xF800);
+    const __m128i surrogateBits = _mm_set1_epi16((short) 0xD800);
+    const __m128i above7Bits = _mm_set1_epi16((short) 0xFF80);
+    const __m128i above11Bits = _mm_set1_epi16((short) 0xF800);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    size_t bytes = 0;
+    for (; i + 8 <= len; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i surrogates = _mm_cmpeq_epi16(
+                _mm_and_si128(v, surrogateMask), surrogateBits);
+        if (_mm_movemask_epi8(surrogates) != 0) break;
+        // Every unit is 3 bytes, less one for each threshold it is below.
+        // The masks have two bits per unit.
+        const int oneByte = _mm_movemask_epi8(
+                _mm_cmpeq_epi16(_mm_and_si128(v, above7Bits), zero));
+        const int twoBytes = _mm_movemask_epi8(
+                _mm_cmpeq_epi16(_mm_and_si128(v, above11Bits), zero));
+        bytes += 8*3 - (__builtin_popcount(oneByte) + __builtin_popcount(twoBytes))/2;
+    }
+    *ioLen += bytes;
+    return i + bmp_utf8_length_scalar(src + i, len - i, ioLen);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_prefix8_avx2(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const unsigned mask = _mm256_movemask_epi8(
+                _mm256_loadu_si256((const __m256i*)(src + i)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + ascii_prefix8_scalar(src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii8_to_16_avx2(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_movemask_epi8(v) != 0) break;
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16),
+                _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+    }
+    return i + ascii8_to_16_scalar(src + i, len - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii16_to_8_avx2(const char16_t* src, size_t len, char* dst)
+{
+    const __m256i nonAscii = _mm256_set1_epi16((short) 0xFF80);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), nonAscii)) break;
+        // packus works within 128-bit lanes; put the quadwords back in order.
+        const __m256i packed = _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i*)(dst + i), packed);
+    }
+    return i + ascii16_to_8_scalar(src + i, len - i, dst + i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t bmp_utf8_length_avx2(const char16_t* src, size_t len, size_t* ioLen)
+{
+    const __m256i surrogateMask = _mm256_set1_epi16((short) 0xF800);
+    const __m256i surrogateBits = _mm256_set1_epi16((short) 0xD800);
+    const __m256i above7Bits = _mm256_set1_epi16((short) 0xFF80);
+    const __m256i above11Bits = _mm256_set1_epi16((short) 0xF800);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    size_t bytes = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        const __m256i surrogates = _mm256_cmpeq_epi16(
+                _mm256_and_si256(v, surrogateMask), surrogateBits);
+        if (!_mm256_testz_si256(surrogates, surrogates)) break;
+        const unsigned oneByte = _mm256_movemask_epi8(
+                _mm256_cmpeq_epi16(_mm256_and_si256(v, above7Bits), zero));
+        const unsigned twoBytes = _mm256_movemask_epi8(
+                _mm256_cmpeq_epi16(_mm256_and_si256(v, above11Bits), zero));
+        bytes += 16*3 - (__builtin_popcount(oneByte) + __builtin_popcount(twoBytes))/2;
+    }
+    *ioLen += bytes;
+    return i + bmp_utf8_length_scalar(src + i, len - i, ioLen);
+}
+
+static const unicode_kernels kSse2Kernels = {
+    ascii_prefix8_sse2,
+    ascii8_to_16_sse2,
+    ascii16_to_8_sse2,
+    bmp_utf8_length_sse2,
+};
+
+static const unicode_kernels kAvx2Kernels = {
+    ascii_prefix8_avx2,
+    ascii8_to_16_avx2,
+    ascii16_to_8_avx2,
+    bmp_utf8_length_avx2,
+};
+
+#endif // UNICODE_X86_SIMD
+
+static const unicode_kernels* select_kernels()
+{
+#ifdef UNICODE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return &kAvx2Kernels;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &kSse2Kernels;
+    }
+#endif
+    return &kScalarKernels;
+}
+
+static const unicode_kernels* gKernels = NULL;
+
+// Racing callers all pick the same table, so no locking is needed.
+static inline const unicode_kernels* kernels()
+{
+    const unicode_kernels* k = gKernels;
+    if (k == NULL) {
+        k = select_kernels();
+        gKernels = k;
+    }
+    return k;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -336,10 +597,20 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
         return;
     }
 
+    const unicode_kernels* const k = kernels();
     const char16_t* cur_utf16 = src;
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        if (*cur_utf16 < 0x80) {
+            const size_t ascii = k->ascii16_to_8(cur_utf16, end_utf16 - cur_utf16, cur);
+            cur_utf16 += ascii;
+            cur += ascii;
+            if (cur_utf16 >= end_utf16) {
+                break;
+            }
+        }
+
         char32_t utf32;
         // surrogate pairs
         if ((*cur_utf16 & 0xFC00) == 0xD800) {
@@ -409,9 +680,17 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
         return -1;
     }
 
+    const unicode_kernels* const k = kernels();
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        if ((*src & 0xF800) != 0xD800) {
+            src += k->bmp_utf8_length(src, end - src, &ret);
+            if (src >= end) {
+                break;
+            }
+        }
+
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*++src & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -522,8 +801,18 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     const uint8_t* u8cur = u8str;
 
     /* Validate that the UTF-8 is the correct len */
+    const unicode_kernels* const k = kernels();
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            const size_t ascii = k->ascii_prefix8(u8cur, u8end - u8cur);
+            u16measuredLen += ascii;
+            u8cur += ascii;
+            if (u8cur >= u8end) {
+                break;
+            }
+        }
+
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -548,7 +837,17 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     const uint8_t* u8cur = u8str;
     char16_t* u16cur = u16str;
 
+    const unicode_kernels* const k = kernels();
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            const size_t ascii = k->ascii8_to_16(u8cur, u8end - u8cur, u16cur);
+            u8cur += ascii;
+            u16cur += ascii;
+            if (u8cur >= u8end) {
+                break;
+            }
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
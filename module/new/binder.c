@@ -40,6 +40,9 @@
 
 
 #define OBJ_HASH_BUCKET_SIZE			128
+#define MAX_MMAP_REGIONS			4
+#define MAX_MMAP_BUCKETS			16
+#define MAX_MMAP_ALLOC_SHIFT			16
 #define MAX_TRACE_DEPTH				4
 #define MSG_BUF_ALIGN(n)			(((n) & (sizeof(void *) - 1)) ? ALIGN((n), sizeof(void *)) : (n))
 #define OBJ_IS_BINDER(o)			((o)->owner_queue)
@@ -47,6 +50,11 @@
 #define DUMP_MSG(pid, tid, wrt, msg)		//_dump_msg(pid, tid, wrt, msg)
 
 
+static unsigned long max_mmap_size = 16 * 1024 * 1024;
+module_param(max_mmap_size, ulong, 0644);
+MODULE_PARM_DESC(max_mmap_size, "largest single mapping of the device, in bytes");
+
+
 enum {	// compat: review looper idea
 	BINDER_LOOPER_STATE_INVALID     = 0x00,
 	BINDER_LOOPER_STATE_REGISTERED  = 0x01,
@@ -59,6 +67,12 @@ typedef enum {
 } binder_event_t;
 
 
+struct binder_region {
+	struct fast_slob *slob;
+	int uses;
+	unsigned long ustart;
+};
+
 struct binder_proc {
 	spinlock_t lock;
 	struct rb_root thread_tree;
@@ -70,9 +84,11 @@ struct binder_proc {
 
 	struct msg_queue *queue;
 
-	struct fast_slob *slob;
-	int slob_uses;
-	unsigned long ustart;
+	/* regions are only ever added: filled in, then published by
+	   num_regions, so readers need no lock */
+	struct binder_region regions[MAX_MMAP_REGIONS];
+	int num_regions;
+	struct binder_mmap_geometry geometry;	// for the next mmap, 0s for default
 
 	pid_t pid;
 
@@ -173,6 +189,7 @@ struct bcmd_msg {
 	uid_t sender_euid;
 
 	msg_queue_id reply_to;
+	void *reply_cookie;		// TF_TAGGED_REPLY: cookie echoed back with the reply
 
 	int trace_depth;
 	struct bcmd_msg_trace traces[MAX_TRACE_DEPTH];
@@ -469,6 +486,7 @@ static struct bcmd_msg *binder_alloc_msg(size_t data_size, size_t offsets_size)
 	mbuf->buf_size = buf_size;
 
 	msg->buf = mbuf;
+	msg->reply_cookie = NULL;
 	msg->trace_depth = 0;
 	return msg;
 }
@@ -748,6 +766,7 @@ static void proc_queue_release(struct msg_queue *q, void *data)
 	struct binder_proc *proc = data;
 	struct rb_node *n;
 	struct binder_obj *obj;
+	int i;
 
 	if (proc->proc_dir)
 		debugfs_remove_recursive(proc->proc_dir);
@@ -764,8 +783,8 @@ static void proc_queue_release(struct msg_queue *q, void *data)
 		_binder_free_obj(proc, obj);
 	}
 
-	if (proc->slob)
-		fast_slob_destroy(proc->slob);
+	for (i = 0; i < proc->num_regions; i++)
+		fast_slob_destroy(proc->regions[i].slob);
 
 	kfree(proc);
 }
@@ -785,9 +804,8 @@ static struct binder_proc *binder_new_proc(struct file *filp)
 		return NULL;
 	}
 
-	proc->slob = NULL;
-	proc->slob_uses = 0;
-	proc->ustart = 0;
+	proc->num_regions = 0;
+	memset(&proc->geometry, 0, sizeof(proc->geometry));
 	proc->pid = task_tgid_vnr(current);
 	proc->max_threads = 0;
 
@@ -1198,7 +1216,7 @@ static int bcmd_write_transaction(struct binder_proc *proc, struct binder_thread
 {
 	struct bcmd_msg *msg;
 	msg_queue_id to_id;
-	void *binder, *cookie;
+	void *binder, *cookie, *tag = NULL;
 
 	if (bcmd == BC_TRANSACTION) {
 		struct binder_obj *obj;
@@ -1224,6 +1242,11 @@ static int bcmd_write_transaction(struct binder_proc *proc, struct binder_thread
 
 		binder = obj->binder;
 		cookie = obj->cookie;
+
+		/* with TF_TAGGED_REPLY the caller's cookie identifies the transaction, and
+		   is handed back with its reply (or dead reply) */
+		if ((tdata->flags & (TF_TAGGED_REPLY | TF_ONE_WAY)) == TF_TAGGED_REPLY)
+			tag = tdata->cookie;
 	} else {
 		/* compat: pop out the top transaction without checking. The big issue
 		   here is the reply message doesn't carry enough information we could use
@@ -1237,7 +1260,8 @@ static int bcmd_write_transaction(struct binder_proc *proc, struct binder_thread
 		list_del(&msg->list);
 
 		to_id = msg->reply_to;
-		binder = cookie = NULL;		// compat
+		binder = NULL;			// compat
+		cookie = msg->reply_cookie;	// NULL unless the caller tagged it
 
 		msg = binder_realloc_msg(msg, tdata->data_size, tdata->offsets_size);
 		if (!msg)
@@ -1252,6 +1276,7 @@ static int bcmd_write_transaction(struct binder_proc *proc, struct binder_thread
 	msg->sender_pid = proc->pid;
 	msg->sender_euid = current->cred->euid;
 	msg->reply_to = msg_queue_id(thread->queue);	// reply queue & indicating source
+	msg->reply_cookie = tag;
 
 	if (tdata->data_size > 0) {
 		if (bcmd_write_msg_buf(proc, thread, msg->buf, tdata) < 0)
@@ -1284,22 +1309,60 @@ failed_reply:
 	return _binder_write_cmd(thread->queue, NULL, NULL, BR_FAILED_REPLY);
 }
 
+static struct binder_region *binder_find_region(struct binder_proc *proc, unsigned long uaddr)
+{
+	int i, n = proc->num_regions;
+
+	smp_rmb();
+	for (i = 0; i < n; i++) {
+		struct binder_region *region = &proc->regions[i];
+		size_t size = region->slob->end - region->slob->start;
+
+		if (region->ustart && uaddr >= region->ustart && uaddr < region->ustart + size)
+			return region;
+	}
+	return NULL;
+}
+
+static struct slob_buf *binder_alloc_buf(struct binder_proc *proc, size_t size, struct binder_region **pregion)
+{
+	int i, n = proc->num_regions;
+
+	smp_rmb();
+	for (i = 0; i < n; i++) {
+		struct binder_region *region = &proc->regions[i];
+		struct slob_buf *sbuf;
+
+		if (!region->ustart)
+			continue;
+
+		sbuf = fast_slob_alloc(region->slob, size);
+		if (sbuf) {
+			*pregion = region;
+			return sbuf;
+		}
+	}
+	return NULL;
+}
+
 static int bcmd_write_free_buffer(struct binder_proc *proc, struct binder_thread *thread, void *uaddr)
 {
 	size_t off;
+	struct binder_region *region;
 	struct slob_buf *sbuf;
 	int bucket;
 
-	if (!proc->slob || !proc->ustart || (unsigned long)uaddr < proc->ustart) {
-		printk("binder: pid %d (tid %d) trying to free an invalid buffer %p, slob %p, ustart %lx\n",
-			proc->pid, thread->pid, uaddr, proc->slob, proc->ustart);
+	region = binder_find_region(proc, (unsigned long)uaddr);
+	if (!region) {
+		printk("binder: pid %d (tid %d) trying to free an invalid buffer %p, regions %d\n",
+			proc->pid, thread->pid, uaddr, proc->num_regions);
 		return -EINVAL;
 	}
 
-	off = (unsigned long)uaddr - proc->ustart - (unsigned long)(((struct slob_buf *)0)->data);
-	sbuf = (struct slob_buf *)(proc->slob->start + off);
+	off = (unsigned long)uaddr - region->ustart - (unsigned long)(((struct slob_buf *)0)->data);
+	sbuf = (struct slob_buf *)(region->slob->start + off);
 
-	bucket = fast_slob_bucket(proc->slob, sbuf);
+	bucket = fast_slob_bucket(region->slob, sbuf);
 	if (bucket < 0 || (sbuf->uaddr_data != (unsigned long)uaddr)) {
 		printk("binder: pid %d (tid %d) trying to free an invalid buffer %p, bucket %d, sbuf %p\n",
 			proc->pid, thread->pid, uaddr, bucket, sbuf);
@@ -1329,7 +1392,7 @@ static int bcmd_write_free_buffer(struct binder_proc *proc, struct binder_thread
 		}
 	}
 
-	_fast_slob_free(proc->slob, bucket, sbuf);
+	_fast_slob_free(region->slob, bucket, sbuf);
 	return 0;
 }
 
@@ -1573,22 +1636,31 @@ static long bcmd_read_transaction(struct binder_proc *proc, struct binder_thread
 
 	data_size = MSG_BUF_ALIGN(mbuf->data_size) + MSG_BUF_ALIGN(mbuf->offsets_size);
 	if (data_size > 0) {
+		struct binder_region *region;
 		struct slob_buf *sbuf;
 
-		if (proc->slob && proc->ustart) {
-			sbuf = fast_slob_alloc(proc->slob, sizeof(*sbuf) + data_size);
-			if (!sbuf) {
-				printk("binder: pid %d (tid %d) failed to allocate transaction data (%u)\n",
-					proc->pid, thread->pid, data_size);
-				return -ENOMEM;
-			}
-		} else
+		if (!proc->num_regions)
 			return -ENOMEM;
 
+		sbuf = binder_alloc_buf(proc, sizeof(*sbuf) + data_size, &region);
+		if (!sbuf) {
+			/* nothing has been done with a transaction yet, so it can go back
+			   on the queue until the process has buffers again; a reply can't,
+			   as its caller may give up and then take it for the next call's */
+			if (msg->type == BC_TRANSACTION)
+				return -ENOBUFS;
+
+			printk("binder: pid %d (tid %d) failed to allocate reply data (%zu)\n",
+				proc->pid, thread->pid, data_size);
+			if (thread->pending_replies > 0)
+				thread->pending_replies--;
+			return -ENOMEM;
+		}
+
 		sbuf->data_size = mbuf->data_size;
 		sbuf->offsets_size = mbuf->offsets_size;
 
-		sbuf->uaddr_data = proc->ustart + (sbuf->data - proc->slob->start);
+		sbuf->uaddr_data = region->ustart + (sbuf->data - region->slob->start);
 		tdata.data.ptr.buffer = (void *)sbuf->uaddr_data;
 
 		if (mbuf->offsets_size > 0) {
@@ -1753,19 +1825,29 @@ static long bcmd_read_dead_binder(struct binder_proc *proc, struct binder_thread
 static long bcmd_read_dead_reply(struct binder_proc *proc, struct binder_thread *thread, struct bcmd_msg **pmsg, void __user *buf, unsigned long size)
 {
 	uint32_t cmd = (*pmsg)->type;
+	void *tag = (*pmsg)->reply_cookie;
+	long n = sizeof(cmd);
 
-	if (size < sizeof(cmd))
+	if (cmd == BR_DEAD_REPLY && tag) {
+		cmd = BR_DEAD_TAGGED_REPLY;
+		n += sizeof(tag);
+	}
+
+	if (size < n)
 		return -ENOSPC;
 
-	if (cmd == BR_DEAD_REPLY && thread->pending_replies > 0)
+	if (cmd != BR_FAILED_REPLY && thread->pending_replies > 0)
 		thread->pending_replies--;
 
 	if (put_user(cmd, (uint32_t *)buf))
 		return -EFAULT;
+	if (cmd == BR_DEAD_TAGGED_REPLY &&
+	    put_user(tag, (void **)((char *)buf + sizeof(cmd))))
+		return -EFAULT;
 
 	kfree(*pmsg);
 	*pmsg = NULL;
-	return sizeof(cmd);
+	return n;
 }
 
 static long bcmd_read_acquire(struct binder_proc *proc, struct binder_thread *thread, struct bcmd_msg **pmsg, void __user *buf, unsigned long size)
@@ -1849,7 +1931,7 @@ static long binder_thread_read(struct binder_proc *proc, struct binder_thread *t
 	char __user *p = buf;
 	ssize_t size = end - buf;
 	int proc_looper = 0, force_return = 0;
-	long n;
+	long n = 0;
 
 	if (thread->state & BINDER_LOOPER_STATE_READY) {	// compat: only ready threads can request spawn
 		n = bcmd_spawn_on_busy(proc, thread, p, size);
@@ -1867,7 +1949,9 @@ static long binder_thread_read(struct binder_proc *proc, struct binder_thread *t
 			atomic_inc(&proc->proc_loopers);
 		}
 
-		if (msg_queue_empty(q) && thread->non_block)
+		/* a non-blocking thread doesn't wait for process work, but a reply
+		   it is waiting for is worth blocking on */
+		if (msg_queue_empty(q) && thread->non_block && q == proc->queue)
 			break;
 
 		n = _bcmd_read_msg(q, &msg);
@@ -1888,7 +1972,9 @@ static long binder_thread_read(struct binder_proc *proc, struct binder_thread *t
 
 			case BR_TRANSACTION_COMPLETE:
 				n = bcmd_read_transaction_complete(proc, thread, &msg, p, size);
-				force_return = 1;
+				/* a batch of oneway transactions leaves a COMPLETE per
+				   transaction; hand them back in one read */
+				force_return = msg_queue_empty(thread->queue);
 				break;
 
 			case BC_ACQUIRE:
@@ -1925,24 +2011,25 @@ static long binder_thread_read(struct binder_proc *proc, struct binder_thread *t
 				goto clean_up;
 		}
 
-		if (msg && (n != -ENOSPC))
+		if (msg && (n != -ENOSPC) && (n != -ENOBUFS))
 			kfree(msg);
 
 		if (n > 0) {
 			p += n;
 			size -= n;
 		} else if (n < 0) {
-			if (n == -ENOSPC) {
+			if (n == -ENOSPC || n == -ENOBUFS) {
 				if (msg) {	// put msg back to the queue
-					printk("binder: proc %d (tid %d): not enough read space, put message back\n",
-						proc->pid, thread->pid);
 					n = _bcmd_write_msg_head(q, msg);
 					if (n < 0) {
 						kfree(msg);
 						goto clean_up;
 					}
 				}
-				n = 0;		// TODO: review no-space handling
+				/* the rest waits for the next read, unless nothing fit at all:
+				   tell the caller its buffer (or mapping) is too small rather
+				   than returning an empty read it can't tell from no work */
+				n = (p == buf) ? n : 0;
 			}
 			break;
 		}
@@ -2103,6 +2190,47 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				return -EFAULT;
 			return 0;
 
+		case BINDER_GET_FEATURES:
+			if (size != sizeof(int))
+				return -EINVAL;
+			if (put_user(BINDER_FEATURE_TAGGED_REPLY | BINDER_FEATURE_NON_BLOCK |
+				     BINDER_FEATURE_MMAP_REGIONS, (int *)ubuf))
+				return -EFAULT;
+			return 0;
+
+		case BINDER_SET_MMAP_GEOMETRY: {
+			struct binder_mmap_geometry g;
+
+			if (size != sizeof(g))
+				return -EINVAL;
+			if (copy_from_user(&g, ubuf, sizeof(g)))
+				return -EFAULT;
+
+			// All 0s restores the default; otherwise keep the values
+			// within what fast_slob_create() can shift safely.
+			if (g.num_buckets != 0 &&
+			    (g.num_buckets < 1 || g.num_buckets > MAX_MMAP_BUCKETS ||
+			     g.alloc_size_shift < 1 || g.alloc_size_shift > MAX_MMAP_ALLOC_SHIFT ||
+			     g.alloc_size_shift * (g.num_buckets - 1) >= 31 ||
+			     g.max_alloc_size < (signed long)MIN_ALLOC_SIZE || g.max_alloc_size > INT_MAX))
+				return -EINVAL;
+
+			proc->geometry = g;
+			return 0;
+		}
+
+		case BINDER_SET_NON_BLOCK: {
+			int non_block;
+
+			if (size != sizeof(int))
+				return -EINVAL;
+			if (get_user(non_block, (int *)ubuf))
+				return -EFAULT;
+
+			thread->non_block = non_block ? 1 : 0;
+			return 0;
+		}
+
 		case BINDER_SET_CONTEXT_MGR:
 			return cmd_set_context_mgr(proc);
 
@@ -2139,17 +2267,17 @@ static int binder_flush(struct file *filp, fl_owner_t id)
 
 static void binder_vm_open(struct vm_area_struct *vma)
 {
-	struct binder_proc *proc = vma->vm_private_data;
+	struct binder_region *region = vma->vm_private_data;
 
-	proc->slob_uses++;
+	region->uses++;
 }
 
 static void binder_vm_close(struct vm_area_struct *vma)
 {
-	struct binder_proc *proc = vma->vm_private_data;
+	struct binder_region *region = vma->vm_private_data;
 
-	if (--proc->slob_uses <= 0)
-		proc->ustart = 0;
+	if (--region->uses <= 0)
+		region->ustart = 0;
 }
 
 static struct vm_operations_struct binder_vm_ops = {
@@ -2160,38 +2288,47 @@ static struct vm_operations_struct binder_vm_ops = {
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	struct binder_proc *proc = filp->private_data;
+	struct binder_mmap_geometry *g = &proc->geometry;
+	struct binder_region *region;
 	size_t size = vma->vm_end - vma->vm_start;
 	int r;
 
-	if (size > 4096 * 1024)		// compat
-		size = 4096 * 1024;
+	if (size > max_mmap_size)
+		size = max_mmap_size;
 
 	if (vma->vm_flags & VM_WRITE)
 		return -EPERM;
 
-	if (proc->ustart || proc->slob)	// TODO: free existing slob?
+	/* mmap_sem keeps two mmaps of the same process from racing here */
+	if (proc->num_regions >= MAX_MMAP_REGIONS)
 		return -EBUSY;
+	region = &proc->regions[proc->num_regions];
 
+	if (g->num_buckets > 0)
+		region->slob = fast_slob_create(size, g->max_alloc_size, g->alloc_size_shift, g->num_buckets);
 	/* compat: sericemanager has a map size of 128K and the rest uses (1024-8)k */
-	if (size < 512 * 1024)
-		proc->slob = fast_slob_create(size, 16 * 1024, 4, 2);
+	else if (size < 512 * 1024)
+		region->slob = fast_slob_create(size, 16 * 1024, 4, 2);
 	else
-		proc->slob = fast_slob_create(size, 128 * 1024, 3, 4);
-	if (!proc->slob)
-		return -ENOMEM;
+		region->slob = fast_slob_create(size, 128 * 1024, 3, 4);
+	if (!region->slob)
+		return g->num_buckets > 0 ? -EINVAL : -ENOMEM;
 
-	r = remap_vmalloc_range(vma, proc->slob->start, 0);
+	r = remap_vmalloc_range(vma, region->slob->start, 0);
 	if (r < 0) {
-		fast_slob_destroy(proc->slob);
-		proc->slob = NULL;
+		fast_slob_destroy(region->slob);
+		region->slob = NULL;
 		return r;
 	}
 	vma->vm_flags = vma->vm_flags | VM_DONTCOPY | VM_DONTEXPAND;
 	vma->vm_ops = &binder_vm_ops;
-	vma->vm_private_data = proc;
+	vma->vm_private_data = region;
+
+	region->ustart = vma->vm_start;
+	region->uses = 1;
 
-	proc->ustart = vma->vm_start;
-	proc->slob_uses = 1;
+	smp_wmb();
+	proc->num_regions++;
 	return 0;
 }
 
@@ -2206,6 +2343,7 @@ static int debugfs_proc_info(struct seq_file *seq, void *start)
 	seq_printf(seq, "registered_loopers: %d\n", atomic_read(&proc->registered_loopers));
 	seq_printf(seq, "proc_loopers: %d\n", atomic_read(&proc->proc_loopers));
 	seq_printf(seq, "requested_loopers: %d\n", atomic_read(&proc->requested_loopers));
+	seq_printf(seq, "mmap_regions: %d\n", proc->num_regions);
 
 	return 0;
 }
@@ -81,6 +81,18 @@ struct binder_version {
 	signed long	protocol_version;
 };
 
+/*
+ * Use with BINDER_SET_MMAP_GEOMETRY: how the next mapping of the process
+ * is divided up.  num_buckets buckets of equal size hold buffers of up to
+ * max_alloc_size, each bucket's buffers alloc_size_shift bits smaller than
+ * the next one's.
+ */
+struct binder_mmap_geometry {
+	signed long	max_alloc_size;
+	signed long	alloc_size_shift;
+	signed long	num_buckets;
+};
+
 /* This is the current protocol version. */
 #define BINDER_CURRENT_PROTOCOL_VERSION 7
 
@@ -91,6 +103,40 @@ struct binder_version {
 #define	BINDER_SET_CONTEXT_MGR		_IOW('b', 7, int)
 #define	BINDER_THREAD_EXIT		_IOW('b', 8, int)
 #define BINDER_VERSION			_IOWR('b', 9, struct binder_version)
+#define BINDER_GET_FEATURES		_IOR('b', 10, int)
+#define BINDER_SET_NON_BLOCK		_IOW('b', 11, int)
+#define BINDER_SET_MMAP_GEOMETRY	_IOW('b', 12, struct binder_mmap_geometry)
+
+/*
+ * Optional protocol extensions, reported by BINDER_GET_FEATURES.  Drivers
+ * that don't know the ioctl support none of them.
+ *
+ * BINDER_FEATURE_TAGGED_REPLY: a thread may have several two-way
+ * transactions outstanding.  For a bcTRANSACTION sent with
+ * TF_TAGGED_REPLY, the brREPLY carries the cookie given with the
+ * transaction, and if the target dies brDEAD_TAGGED_REPLY is returned
+ * with that cookie instead of brDEAD_REPLY.
+ */
+#define BINDER_FEATURE_TAGGED_REPLY	0x01
+
+/*
+ * BINDER_FEATURE_NON_BLOCK: BINDER_SET_NON_BLOCK sets whether reads on the
+ * calling thread wait for process work.  A non-blocking thread returns
+ * from BINDER_WRITE_READ as soon as it has nothing queued, so it can poll()
+ * the descriptor from an event loop.  It still waits for its own replies.
+ */
+#define BINDER_FEATURE_NON_BLOCK	0x02
+
+/*
+ * BINDER_FEATURE_MMAP_REGIONS: a process may mmap the device more than
+ * once; each mapping is another region to receive transactions in, and
+ * BINDER_SET_MMAP_GEOMETRY shapes the ones that follow.  When no region
+ * has a buffer for an incoming transaction, it stays queued and the read
+ * fails with -ENOBUFS, so the process can add a region (or free buffers)
+ * and read again.  A reply that doesn't fit fails the read with -ENOMEM
+ * and is dropped, as before.
+ */
+#define BINDER_FEATURE_MMAP_REGIONS	0x04
 
 /*
  * NOTE: Two special error codes you should check for when calling
@@ -112,6 +158,8 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_TAGGED_REPLY	= 0x20,	/* reply carries the transaction's cookie, see
+				   BINDER_FEATURE_TAGGED_REPLY */
 };
 
 struct binder_transaction_data {
@@ -249,6 +297,12 @@ enum BinderDriverReturnProtocol {
 	 * The the last transaction (either a bcTRANSACTION or
 	 * a bcATTEMPT_ACQUIRE) failed (e.g. out of memory).  No parameters.
 	 */
+
+	BR_DEAD_TAGGED_REPLY = _IOR('r', 18, void *),
+	/*
+	 * void *: cookie of the TF_TAGGED_REPLY transaction whose target is
+	 * no longer with us
+	 */
 };
 
 enum BinderDriverCommandProtocol {
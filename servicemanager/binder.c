@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
 #define BUF_ALIGN(x)		(((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
@@ -91,6 +92,7 @@ struct binder_state
     int fd;
     void *mapped;
     unsigned mapsize;
+    binder_reply_sent reply_sent;
 };
 
 struct binder_state *binder_open(unsigned mapsize)
@@ -111,6 +113,7 @@ struct binder_state *binder_open(unsigned mapsize)
     }
 
     bs->mapsize = mapsize;
+    bs->reply_sent = 0;
     bs->mapped = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, bs->fd, 0);
     if (bs->mapped == MAP_FAILED) {
         fprintf(stderr,"binder: cannot map device (%s)\n",
@@ -227,15 +230,17 @@ int binder_parse(struct binder_state *bs, struct binder_io *bio,
             }
             binder_dump_txn(txn);
             if (func) {
-                unsigned rdata[256/4];
+                unsigned rdata[1024/4];
                 struct binder_io msg;
                 struct binder_io reply;
                 int res;
 
-                bio_init(&reply, rdata, sizeof(rdata), 4);
+                bio_init(&reply, rdata, sizeof(rdata), SVC_MGR_MAX_CHECK_SERVICES);
                 bio_init_from_txn(&msg, txn);
                 res = func(bs, txn, &msg, &reply);
                 binder_send_reply(bs, &reply, txn->data, res);
+                if (bs->reply_sent)
+                    bs->reply_sent(bs);
             }
             ptr += sizeof(*txn) / sizeof(uint32_t);
 #ifdef INLINE_TRANSACTION_DATA
@@ -263,15 +268,19 @@ int binder_parse(struct binder_state *bs, struct binder_io *bio,
             r = 0;
             break;
         }
-        case BR_DEAD_BINDER: {
+        case BR_DEAD_BINDER:
+        case BR_CLEAR_DEATH_NOTIFICATION_DONE: {
             struct binder_death *death = (void*) *ptr++;
             death->func(bs, death->ptr);
             break;
         }
         case BR_FAILED_REPLY:
-            r = -1;
-            break;
         case BR_DEAD_REPLY:
+            if (func) {
+                /* from a binder_send_oneway() made while handling a
+                 * transaction; the target is gone, nothing to do. */
+                break;
+            }
             r = -1;
             break;
         default:
@@ -308,6 +317,15 @@ void binder_link_to_death(struct binder_state *bs, void *ptr, struct binder_deat
     binder_write(bs, cmd, sizeof(cmd));
 }
 
+void binder_clear_death(struct binder_state *bs, void *ptr, struct binder_death *death)
+{
+    uint32_t cmd[3];
+    cmd[0] = BC_CLEAR_DEATH_NOTIFICATION;
+    cmd[1] = (uint32_t) ptr;
+    cmd[2] = (uint32_t) death;
+    binder_write(bs, cmd, sizeof(cmd));
+}
+
 
 int binder_call(struct binder_state *bs,
                 struct binder_io *msg, struct binder_io *reply,
@@ -367,14 +385,43 @@ fail:
     return -1;
 }
 
+int binder_send_oneway(struct binder_state *bs, struct binder_io *msg,
+                       void *target, uint32_t code)
+{
+    struct {
+        uint32_t cmd;
+        struct binder_txn txn;
+    } writebuf;
+
+    if (msg->flags & BIO_F_OVERFLOW) {
+        fprintf(stderr,"binder: txn buffer overflow\n");
+        return -1;
+    }
+
+    writebuf.cmd = BC_TRANSACTION;
+    writebuf.txn.target = target;
+    writebuf.txn.cookie = 0;
+    writebuf.txn.code = code;
+    writebuf.txn.flags = TF_ONE_WAY;
+    writebuf.txn.data_size = msg->data - msg->data0;
+    writebuf.txn.offs_size = ((char*) msg->offs) - ((char*) msg->offs0);
+    writebuf.txn.data = msg->data0;
+    writebuf.txn.offs = msg->offs0;
+
+    hexdump(msg->data0, msg->data - msg->data0);
+    return binder_write(bs, &writebuf, sizeof(writebuf));
+}
+
 void binder_loop(struct binder_state *bs, binder_handler func)
 {
     int res;
     struct binder_write_read bwr;
+    /* big enough that one ioctl drains a burst of queued work (refcount
+     * commands, death notifications, a transaction) in one go */
 #ifdef INLINE_TRANSACTION_DATA
     unsigned readbuf[1024];
 #else
-    unsigned readbuf[32];
+    unsigned readbuf[256];
 #endif
 
     bwr.write_size = 0;
@@ -408,6 +455,47 @@ void binder_loop(struct binder_state *bs, binder_handler func)
     }
 }
 
+struct binder_looper
+{
+    struct binder_state *bs;
+    binder_handler func;
+};
+
+static void *binder_looper_main(void *arg)
+{
+    struct binder_looper *looper = arg;
+    binder_loop(looper->bs, looper->func);
+    return 0;
+}
+
+void binder_loop_threads(struct binder_state *bs, binder_handler func,
+                         binder_reply_sent sent, unsigned nthreads)
+{
+    static struct binder_looper looper;
+    pthread_attr_t attr;
+    pthread_t thread;
+    unsigned n;
+    int err;
+
+    bs->reply_sent = sent;
+    looper.bs = bs;
+    looper.func = func;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (n = 1; n < nthreads; n++) {
+        err = pthread_create(&thread, &attr, binder_looper_main, &looper);
+        if (err) {
+            LOGE("binder_loop: cannot start looper %u (%s)\n",
+                 n, strerror(err));
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    binder_loop(bs, func);
+}
+
 void bio_init_from_txn(struct binder_io *bio, struct binder_txn *txn)
 {
     bio->data = bio->data0 = txn->data;
@@ -504,11 +592,20 @@ void bio_put_ref(struct binder_io *bio, void *ptr)
 {
     struct binder_object *obj;
 
-    if (ptr)
-        obj = bio_alloc_obj(bio);
-    else
+    if (!ptr) {
+        /* a null reference is written the way Parcel writes a null
+         * binder: a zeroed object with no offsets entry, so the driver
+         * leaves it alone.  Handle 0 would read back as the context
+         * manager, and so would binder 0 if the driver translated it. */
         obj = bio_alloc(bio, sizeof(*obj));
+        if (!obj)
+            return;
+        memset(obj, 0, sizeof(*obj));
+        obj->type = BINDER_TYPE_BINDER;
+        return;
+    }
 
+    obj = bio_alloc_obj(bio);
     if (!obj)
         return;
 
@@ -81,8 +81,20 @@ enum {
     SVC_MGR_CHECK_SERVICE,
     SVC_MGR_ADD_SERVICE,
     SVC_MGR_LIST_SERVICES,
+    SVC_MGR_WAIT_SERVICE,
+    SVC_MGR_CHECK_SERVICES,
 };
 
+/* most names a single SVC_MGR_CHECK_SERVICES may ask for; the reply
+ * carries a count and then one reference (or null) per name
+ */
+#define SVC_MGR_MAX_CHECK_SERVICES 32
+
+/* code of the oneway call made on a SVC_MGR_WAIT_SERVICE callback
+ * once the service is added: string16 name, strong binder service
+ */
+#define SVC_MGR_SERVICE_ADDED 1
+
 typedef int (*binder_handler)(struct binder_state *bs,
                               struct binder_txn *txn,
                               struct binder_io *msg,
@@ -98,6 +110,12 @@ int binder_call(struct binder_state *bs,
                 struct binder_io *msg, struct binder_io *reply,
                 void *target, uint32_t code);
 
+/* queue a oneway binder call; does not wait for the target
+ * - returns zero on success
+ */
+int binder_send_oneway(struct binder_state *bs, struct binder_io *msg,
+                       void *target, uint32_t code);
+
 /* release any state associate with the binder_io
  * - call once any necessary data has been extracted from the
  *   binder_io after binder_call() returns
@@ -112,8 +130,26 @@ void binder_release(struct binder_state *bs, void *ptr);
 
 void binder_link_to_death(struct binder_state *bs, void *ptr, struct binder_death *death);
 
+/* undo binder_link_to_death(); death->func is called once more when the
+ * driver confirms, or when the death raced with the clear, after which
+ * death is no longer referenced and can be freed
+ */
+void binder_clear_death(struct binder_state *bs, void *ptr, struct binder_death *death);
+
 void binder_loop(struct binder_state *bs, binder_handler func);
 
+/* called on the handling thread once the reply to a transaction
+ * passed to the binder_handler has been sent
+ */
+typedef void (*binder_reply_sent)(struct binder_state *bs);
+
+/* run binder_loop() on nthreads threads, the caller being one of them,
+ * so func may be called concurrently
+ * - returns when the calling thread's loop fails
+ */
+void binder_loop_threads(struct binder_state *bs, binder_handler func,
+                         binder_reply_sent sent, unsigned nthreads);
+
 int binder_become_context_manager(struct binder_state *bs);
 
 /* allocate a binder_io, providing a stack-allocated working
@@ -6,9 +6,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
-
+#include <unistd.h>
+#include <pthread.h>
 
 #include "binder.h"
+#include "svcreg.h"
+#include "svcperm.h"
 
 #define LOGI(x...) fprintf(stdout, "svcmgr: " x)
 #define LOGE(x...) fprintf(stderr, "svcmgr: " x)
@@ -19,10 +22,21 @@
 #define AID_RADIO	1
 #define AID_SYSTEM	1
 
-/* TODO:
- * These should come from a config file or perhaps be
- * based on some namespace rules of some sort (media
- * uid can register media.*, etc)
+#define SVC_PERM_CONFIG "/system/etc/servicemanager.conf"
+
+static struct {
+    const char *name;
+    unsigned uid;
+} aids[] = {
+    { "media",  AID_MEDIA },
+    { "drm",    AID_DRM },
+    { "nfc",    AID_NFC },
+    { "radio",  AID_RADIO },
+    { "system", AID_SYSTEM },
+};
+
+/* Used when there is no config file (see svcperm_load() for the
+ * format, and "media.*" for a whole namespace).
  */
 static struct {
     unsigned uid;
@@ -51,10 +65,23 @@ static struct {
 
 void *svcmgr_handle;
 
-const char *str8(uint16_t *x)
+/* Guards the registry and the wait list.  svcmgr_handler() takes it for
+ * each transaction (shared for lookups, exclusive for changes) and it is
+ * dropped in svcmgr_reply_sent() once the reply is out, so a handle we
+ * reply with can't be released by a concurrent death notification and
+ * handed out again in the meantime.
+ */
+pthread_rwlock_t svclock = PTHREAD_RWLOCK_INITIALIZER;
+
+#define DEFAULT_LOOPER_THREADS 4
+#define MAX_LOOPER_THREADS 32
+
+/* for logging; buf is the caller's since the looper threads log at once */
+#define STR8_SIZE 128
+
+const char *str8(uint16_t *x, char *buf)
 {
-    static char buf[128];
-    unsigned max = 127;
+    unsigned max = STR8_SIZE - 1;
     char *p = buf;
 
     if (x) {
@@ -66,61 +93,236 @@ const char *str8(uint16_t *x)
     return buf;
 }
 
-int str16eq(uint16_t *a, const char *b)
+int lookup_aid(const char *name, unsigned *uid)
 {
-    while (*a && *b)
-        if (*a++ != *b++) return 0;
-    if (*a || *b)
-        return 0;
-    return 1;
+    unsigned n;
+
+    for (n = 0; n < sizeof(aids) / sizeof(aids[0]); n++) {
+        if (!strcmp(name, aids[n].name)) {
+            *uid = aids[n].uid;
+            return 0;
+        }
+    }
+    return -1;
 }
 
-int svc_can_register(unsigned uid, uint16_t *name)
+void load_permissions(const char *path)
 {
     unsigned n;
-    
+    int count;
+
+    count = svcperm_load(path, lookup_aid);
+    if (count >= 0) {
+        LOGI("%d registration rules from %s\n", count, path);
+        return;
+    }
+
+    for (n = 0; n < sizeof(allowed) / sizeof(allowed[0]); n++)
+        svcperm_add(allowed[n].uid, allowed[n].name);
+}
+
+int svc_can_register(unsigned uid, uint16_t *name, unsigned len)
+{
     if ((uid == 0) || (uid == AID_SYSTEM))
         return 1;
 
-    for (n = 0; n < sizeof(allowed) / sizeof(allowed[0]); n++)
-        if ((uid == allowed[n].uid) && str16eq(name, allowed[n].name))
-            return 1;
+    return svcperm_allowed(uid, name, len);
+}
 
-    return 0;
+static void svcinfo_death_locked(struct binder_state *bs, struct svcinfo *si)
+{
+    char name8[STR8_SIZE];
+    LOGI("service '%s' died\n", str8(si->name, name8));
+    if (si->ptr) {
+        binder_release(bs, si->ptr);
+        si->ptr = 0;
+    }   
 }
 
-struct svcinfo 
+void svcinfo_death(struct binder_state *bs, void *ptr)
 {
-    struct svcinfo *next;
+    pthread_rwlock_wrlock(&svclock);
+    svcinfo_death_locked(bs, ptr);
+    pthread_rwlock_unlock(&svclock);
+}
+
+/* Clients blocked in waitForService() for a name that is not registered
+ * yet, grouped by name.  Each waiter is a binder we hold a reference on,
+ * linked to death, and call (oneway) when the service is added.  Once
+ * called, a waiter stays allocated until the driver is done with its
+ * death notification.
+ */
+#define MAX_WAITERS_PER_NAME 64
+#define MAX_WAITERS 512
+
+struct svcwait;
+
+struct svcwaiter
+{
+    struct svcwaiter *next;
+    struct svcwait *wait;       /* 0 once notified */
     void *ptr;
     struct binder_death death;
+};
+
+struct svcwait
+{
+    struct svcwait *next;
+    struct svcwaiter *waiters;
+    unsigned count;
     unsigned len;
     uint16_t name[0];
 };
 
-struct svcinfo *svclist = 0;
+struct svcwait *waitlist = 0;
+unsigned waiter_count = 0;
 
-struct svcinfo *find_svc(uint16_t *s16, unsigned len)
+struct svcwait *find_wait(uint16_t *s16, unsigned len)
 {
-    struct svcinfo *si;
+    struct svcwait *sw;
 
-    for (si = svclist; si; si = si->next) {
-        if ((len == si->len) &&
-            !memcmp(s16, si->name, len * sizeof(uint16_t))) {
-            return si;
+    for (sw = waitlist; sw; sw = sw->next) {
+        if ((len == sw->len) &&
+            !memcmp(s16, sw->name, len * sizeof(uint16_t))) {
+            return sw;
         }
     }
     return 0;
 }
 
-void svcinfo_death(struct binder_state *bs, void *ptr)
+static void svcwait_remove(struct svcwait *sw)
 {
-    struct svcinfo *si = ptr;
-    LOGI("service '%s' died\n", str8(si->name));
-    if (si->ptr) {
-        binder_release(bs, si->ptr);
-        si->ptr = 0;
-    }   
+    struct svcwait **p;
+
+    for (p = &waitlist; *p; p = &(*p)->next) {
+        if (*p == sw) {
+            *p = sw->next;
+            break;
+        }
+    }
+    free(sw);
+}
+
+/* The waiter died before the service showed up, or the driver is done
+ * with the death notification of one that has been notified.
+ */
+void svcwaiter_death(struct binder_state *bs, void *ptr)
+{
+    struct svcwaiter *w = ptr, **p;
+    struct svcwait *sw;
+
+    pthread_rwlock_wrlock(&svclock);
+    sw = w->wait;
+    if (sw) {
+        for (p = &sw->waiters; *p; p = &(*p)->next) {
+            if (*p == w) {
+                *p = w->next;
+                break;
+            }
+        }
+        sw->count--;
+        waiter_count--;
+        binder_release(bs, w->ptr);
+        if (!sw->waiters)
+            svcwait_remove(sw);
+    }
+    free(w);
+    pthread_rwlock_unlock(&svclock);
+}
+
+int do_wait_service(struct binder_state *bs,
+                    uint16_t *s, unsigned len,
+                    void *ptr)
+{
+    struct svcwait *sw;
+    struct svcwaiter *w;
+    char name8[STR8_SIZE];
+
+    if (!ptr || (len == 0) || (len > 127))
+        return -1;
+
+    /* Dead waiters are dropped, but a client may keep several waiting
+     * for names that never register; bound them so that can't grow
+     * without limit.  The client falls back to polling checkService. */
+    if (waiter_count >= MAX_WAITERS) {
+        LOGE("wait_service('%s') - TOO MANY WAITERS\n", str8(s, name8));
+        return -1;
+    }
+
+    sw = find_wait(s, len);
+
+    /* A client waiting again with the same callback is already queued. */
+    if (sw) {
+        for (w = sw->waiters; w; w = w->next) {
+            if (w->ptr == ptr)
+                return 0;
+        }
+    }
+
+    if (sw && sw->count >= MAX_WAITERS_PER_NAME) {
+        LOGE("wait_service('%s') - TOO MANY WAITERS\n", str8(s, name8));
+        return -1;
+    }
+
+    w = malloc(sizeof(*w));
+    if (!w)
+        return -1;
+
+    if (!sw) {
+        sw = malloc(sizeof(*sw) + (len + 1) * sizeof(uint16_t));
+        if (!sw) {
+            free(w);
+            return -1;
+        }
+        sw->waiters = 0;
+        sw->count = 0;
+        sw->len = len;
+        memcpy(sw->name, s, len * sizeof(uint16_t));
+        sw->name[len] = '\0';
+        sw->next = waitlist;
+        waitlist = sw;
+    }
+
+    w->wait = sw;
+    w->ptr = ptr;
+    w->death.func = svcwaiter_death;
+    w->death.ptr = w;
+    w->next = sw->waiters;
+    sw->waiters = w;
+    sw->count++;
+    waiter_count++;
+
+    binder_acquire(bs, ptr);
+    binder_link_to_death(bs, ptr, &w->death);
+    return 0;
+}
+
+void notify_waiters(struct binder_state *bs,
+                    uint16_t *s, unsigned len,
+                    void *ptr)
+{
+    struct svcwait *sw;
+    struct svcwaiter *w;
+    unsigned iodata[512/4];
+    struct binder_io msg;
+
+    sw = find_wait(s, len);
+    if (!sw)
+        return;
+
+    while ((w = sw->waiters)) {
+        bio_init(&msg, iodata, sizeof(iodata), 4);
+        bio_put_string16(&msg, sw->name);
+        bio_put_ref(&msg, ptr);
+        binder_send_oneway(bs, &msg, w->ptr, SVC_MGR_SERVICE_ADDED);
+        /* freed by svcwaiter_death() once the clear is confirmed */
+        binder_clear_death(bs, w->ptr, &w->death);
+        binder_release(bs, w->ptr);
+        sw->waiters = w->next;
+        w->wait = 0;
+        waiter_count--;
+    }
+    svcwait_remove(sw);
 }
 
 uint16_t svcmgr_id[] = { 
@@ -134,7 +336,7 @@ void *do_find_service(struct binder_state *bs, uint16_t *s, unsigned len)
     struct svcinfo *si;
     si = find_svc(s, len);
 
-//    LOGI("check_service('%s') ptr = %p\n", str8(s), si ? si->ptr : 0);
+//    LOGI("check_service('%s') ptr = %p\n", str8(s, name8), si ? si->ptr : 0);
     if (si && si->ptr) {
         return si->ptr;
     } else {
@@ -147,14 +349,15 @@ int do_add_service(struct binder_state *bs,
                    void *ptr, unsigned uid)
 {
     struct svcinfo *si;
-//    LOGI("add_service('%s',%p) uid=%d\n", str8(s), ptr, uid);
+    char name8[STR8_SIZE];
+//    LOGI("add_service('%s',%p) uid=%d\n", str8(s, name8), ptr, uid);
 
     if (!ptr || (len == 0) || (len > 127))
         return -1;
 
-    if (!svc_can_register(uid, s)) {
+    if (!svc_can_register(uid, s, len)) {
         LOGE("add_service('%s',%p) uid=%d - PERMISSION DENIED\n",
-             str8(s), ptr, uid);
+             str8(s, name8), ptr, uid);
         return -1;
     }
 
@@ -162,29 +365,25 @@ int do_add_service(struct binder_state *bs,
     if (si) {
         if (si->ptr) {
             LOGE("add_service('%s',%p) uid=%d - ALREADY REGISTERED, OVERRIDE\n",
-                 str8(s), ptr, uid);
-            svcinfo_death(bs, si);
+                 str8(s, name8), ptr, uid);
+            svcinfo_death_locked(bs, si);
         }
         si->ptr = ptr;
     } else {
-        si = malloc(sizeof(*si) + (len + 1) * sizeof(uint16_t));
+        si = svc_insert(s, len);
         if (!si) {
             LOGE("add_service('%s',%p) uid=%d - OUT OF MEMORY\n",
-                 str8(s), ptr, uid);
+                 str8(s, name8), ptr, uid);
             return -1;
         }
         si->ptr = ptr;
-        si->len = len;
-        memcpy(si->name, s, (len + 1) * sizeof(uint16_t));
-        si->name[len] = '\0';
         si->death.func = svcinfo_death;
         si->death.ptr = si;
-        si->next = svclist;
-        svclist = si;
     }
 
     binder_acquire(bs, ptr);
     binder_link_to_death(bs, ptr, &si->death);
+    notify_waiters(bs, s, len, ptr);
     return 0;
 }
 
@@ -202,6 +401,13 @@ int svcmgr_handler(struct binder_state *bs,
 //    LOGI("target=%p code=%d pid=%d uid=%d\n",
 //         txn->target, txn->code, txn->sender_pid, txn->sender_euid);
 
+    /* held until svcmgr_reply_sent(), whatever we return */
+    if ((txn->code == SVC_MGR_ADD_SERVICE) ||
+        (txn->code == SVC_MGR_WAIT_SERVICE))
+        pthread_rwlock_wrlock(&svclock);
+    else
+        pthread_rwlock_rdlock(&svclock);
+
     if (txn->target != svcmgr_handle)
         return -1;
 
@@ -213,7 +419,8 @@ int svcmgr_handler(struct binder_state *bs,
     s = bio_get_string16(msg, &len);
     if ((len != (sizeof(svcmgr_id) / 2)) ||
         memcmp(svcmgr_id, s, sizeof(svcmgr_id))) {
-        fprintf(stderr,"invalid id %s\n", str8(s));
+        char name8[STR8_SIZE];
+        fprintf(stderr,"invalid id %s\n", str8(s, name8));
         return -1;
     }
 
@@ -234,12 +441,37 @@ int svcmgr_handler(struct binder_state *bs,
             return -1;
         break;
 
+    case SVC_MGR_WAIT_SERVICE:
+        s = bio_get_string16(msg, &len);
+        ptr = do_find_service(bs, s, len);
+        if (ptr) {
+            bio_put_ref(reply, ptr);
+            return 0;
+        }
+        ptr = bio_get_ref(msg);
+        if (do_wait_service(bs, s, len, ptr))
+            return -1;
+        break;
+
+    case SVC_MGR_CHECK_SERVICES: {
+        unsigned n, count = bio_get_uint32(msg);
+
+        if (count > SVC_MGR_MAX_CHECK_SERVICES)
+            return -1;
+        bio_put_uint32(reply, count);
+        for (n = 0; n < count; n++) {
+            s = bio_get_string16(msg, &len);
+            if (!s)
+                return -1;
+            bio_put_ref(reply, do_find_service(bs, s, len));
+        }
+        return 0;
+    }
+
     case SVC_MGR_LIST_SERVICES: {
         unsigned n = bio_get_uint32(msg);
 
-        si = svclist;
-        while ((n-- > 0) && si)
-            si = si->next;
+        si = svc_at(n);
         if (si) {
             bio_put_string16(reply, si->name);
             return 0;
@@ -255,10 +487,47 @@ int svcmgr_handler(struct binder_state *bs,
     return 0;
 }
 
+void svcmgr_reply_sent(struct binder_state *bs)
+{
+    pthread_rwlock_unlock(&svclock);
+}
+
 int main(int argc, char **argv)
 {
     struct binder_state *bs;
     void *svcmgr = BINDER_SERVICE_MANAGER;
+    unsigned long threads = DEFAULT_LOOPER_THREADS;
+
+    const char *config = SVC_PERM_CONFIG;
+    char *end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:")) != -1) {
+        switch (opt) {
+        case 'c':
+            config = optarg;
+            break;
+        case 't':
+            /* strtoul would take "-1" or "4x"; neither is a thread count */
+            threads = strtoul(optarg, &end, 10);
+            if (optarg[0] < '0' || optarg[0] > '9' || *end) {
+                fprintf(stderr, "%s: bad looper thread count '%s'\n", argv[0], optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c config] [-t looper_threads]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (threads == 0)
+        threads = 1;
+    if (threads > MAX_LOOPER_THREADS) {
+        LOGE("limiting looper threads to %d\n", MAX_LOOPER_THREADS);
+        threads = MAX_LOOPER_THREADS;
+    }
+
+    load_permissions(config);
 
     bs = binder_open(128*1024);
 
@@ -268,6 +537,6 @@ int main(int argc, char **argv)
     }
 
     svcmgr_handle = svcmgr;
-    binder_loop(bs, svcmgr_handler);
+    binder_loop_threads(bs, svcmgr_handler, svcmgr_reply_sent, threads);
     return 0;
 }
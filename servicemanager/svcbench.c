@@ -0,0 +1,126 @@
+/* Copyright 2008 The Android Open Source Project
+ */
+
+/*
+ * Service registry lookup benchmark
+ *
+ * Fills the registry with a synthetic set of services named like the
+ * ones on a device ("media.player.17", "android.os.IFoo17", ...) and
+ * times find_svc() hits and misses plus a full LIST_SERVICES walk.
+ *
+ *   -s num - number of services to register (default: 4000)
+ *   -n num - number of lookups per measurement (default: 1000000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "svcreg.h"
+
+static const char *prefixes[] = {
+    "media.", "radio.", "android.os.I", "android.hardware.I",
+    "com.android.internal.", "drm.", "sensorservice.", "wifi.",
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned make_name(uint16_t *out, unsigned max,
+                          unsigned n, const char *tag)
+{
+    char buf[128];
+    unsigned len, i;
+
+    snprintf(buf, sizeof(buf), "%s%s%u",
+             prefixes[n % (sizeof(prefixes) / sizeof(prefixes[0]))], tag, n);
+    len = strlen(buf);
+    if (len >= max)
+        len = max - 1;
+    for (i = 0; i < len; i++)
+        out[i] = buf[i];
+    out[len] = 0;
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned services = 4000;
+    unsigned lookups = 1000000;
+    uint16_t (*names)[128];
+    unsigned *lens;
+    unsigned n, found = 0;
+    double start, t;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:?")) != -1) {
+        switch (opt) {
+        case 's':
+            services = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            lookups = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s services] [-n lookups]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (services == 0)
+        services = 1;
+
+    names = malloc(services * sizeof(*names));
+    lens = malloc(services * sizeof(*lens));
+    if (!names || !lens)
+        return 1;
+
+    start = now();
+    for (n = 0; n < services; n++) {
+        lens[n] = make_name(names[n], 128, n, "service");
+        if (!svc_insert(names[n], lens[n])) {
+            fprintf(stderr, "out of memory after %u services\n", n);
+            return 1;
+        }
+    }
+    t = now() - start;
+    printf("services: %u, lookups: %u\n", svc_count(), lookups);
+    printf("  insert: %.1f ns/service\n", t / services * 1e9);
+
+    start = now();
+    for (n = 0; n < lookups; n++) {
+        unsigned i = (n * 2654435761u) % services;
+        if (find_svc(names[i], lens[i]))
+            found++;
+    }
+    t = now() - start;
+    printf("  lookup hit: %.1f ns (%u found)\n", t / lookups * 1e9, found);
+
+    /* same shape of name, never registered */
+    for (n = 0; n < services; n++)
+        lens[n] = make_name(names[n], 128, n, "missing");
+    found = 0;
+    start = now();
+    for (n = 0; n < lookups; n++) {
+        unsigned i = (n * 2654435761u) % services;
+        if (find_svc(names[i], lens[i]))
+            found++;
+    }
+    t = now() - start;
+    printf("  lookup miss: %.1f ns (%u found)\n", t / lookups * 1e9, found);
+
+    start = now();
+    for (n = 0; svc_at(n); n++)
+        ;
+    t = now() - start;
+    printf("  list all: %.1f ns/entry\n", t / services * 1e9);
+
+    free(names);
+    free(lens);
+    return 0;
+}
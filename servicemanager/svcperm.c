@@ -0,0 +1,150 @@
+/* Copyright 2008 The Android Open Source Project
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "svcperm.h"
+
+#define LOGE(x...) fprintf(stderr, "svcmgr: " x)
+
+struct uidset
+{
+    unsigned *uids;
+    unsigned count;
+};
+
+struct permnode
+{
+    struct permnode *child;     /* first child */
+    struct permnode *sibling;
+    struct uidset exact;        /* may register this name */
+    struct uidset prefix;       /* may register any name under it */
+    uint16_t ch;
+};
+
+static struct permnode root;
+
+static int uidset_has(const struct uidset *set, unsigned uid)
+{
+    unsigned n;
+
+    for (n = 0; n < set->count; n++)
+        if (set->uids[n] == uid)
+            return 1;
+    return 0;
+}
+
+static int uidset_add(struct uidset *set, unsigned uid)
+{
+    unsigned *uids;
+
+    if (uidset_has(set, uid))
+        return 0;
+    uids = realloc(set->uids, (set->count + 1) * sizeof(*uids));
+    if (!uids)
+        return -1;
+    uids[set->count++] = uid;
+    set->uids = uids;
+    return 0;
+}
+
+static struct permnode *find_child(struct permnode *node, uint16_t ch)
+{
+    for (node = node->child; node; node = node->sibling)
+        if (node->ch == ch)
+            return node;
+    return 0;
+}
+
+int svcperm_add(unsigned uid, const char *name)
+{
+    struct permnode *node = &root, *child;
+    const unsigned char *p = (const unsigned char *) name;
+
+    for (; *p && !((p[0] == '*') && !p[1]); p++) {
+        child = find_child(node, *p);
+        if (!child) {
+            child = calloc(1, sizeof(*child));
+            if (!child)
+                return -1;
+            child->ch = *p;
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+
+    return uidset_add(*p ? &node->prefix : &node->exact, uid);
+}
+
+int svcperm_allowed(unsigned uid, const uint16_t *name, unsigned len)
+{
+    const struct permnode *node = &root;
+
+    while (len--) {
+        if (uidset_has(&node->prefix, uid))
+            return 1;
+        node = find_child((struct permnode *) node, *name++);
+        if (!node)
+            return 0;
+    }
+    return uidset_has(&node->exact, uid) || uidset_has(&node->prefix, uid);
+}
+
+int svcperm_load(const char *path,
+                 int (*lookup_uid)(const char *name, unsigned *uid))
+{
+    char line[256], uidname[64], name[128];
+    unsigned uid, lineno = 0;
+    char *p, *end;
+    int count = 0, uidend, nameend;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(f)) {
+            LOGE("%s:%u: line too long\n", path, lineno);
+            while (fgets(line, sizeof(line), f) && !strchr(line, '\n'))
+                ;
+            continue;
+        }
+        if ((p = strchr(line, '#')))
+            *p = 0;
+        if (sscanf(line, "%63s%n %127s%n", uidname, &uidend, name, &nameend) != 2) {
+            for (p = line; isspace((unsigned char) *p); p++)
+                ;
+            if (*p)
+                LOGE("%s:%u: expected <uid> <name>\n", path, lineno);
+            continue;
+        }
+        /* %s stops at the width as well as at a space */
+        if ((line[uidend] && !isspace((unsigned char) line[uidend])) ||
+            (line[nameend] && !isspace((unsigned char) line[nameend]))) {
+            LOGE("%s:%u: uid or name too long\n", path, lineno);
+            continue;
+        }
+
+        uid = strtoul(uidname, &end, 10);
+        if ((*end || (end == uidname)) &&
+            (!lookup_uid || lookup_uid(uidname, &uid))) {
+            LOGE("%s:%u: unknown uid '%s'\n", path, lineno, uidname);
+            continue;
+        }
+
+        if (svcperm_add(uid, name)) {
+            LOGE("%s:%u: out of memory\n", path, lineno);
+            break;
+        }
+        count++;
+    }
+
+    fclose(f);
+    return count;
+}
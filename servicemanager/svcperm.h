@@ -0,0 +1,28 @@
+/* Copyright 2008 The Android Open Source Project
+ */
+
+#ifndef _SVCPERM_H_
+#define _SVCPERM_H_
+
+#include "binder.h"
+
+/* Which uids may register which service names, kept in a prefix trie
+ * so a check costs one step per character of the name.  A name ending
+ * in '*' allows every name that starts with the part before it.
+ *
+ * The table is built at start and only read afterwards.
+ */
+
+/* - returns zero on success */
+int svcperm_add(unsigned uid, const char *name);
+
+/* read "<uid> <name>" lines; uid is a number or a name lookup_uid()
+ * resolves ("media", "radio", ...), '#' starts a comment
+ * - returns the number of entries added, or -1 if the file can't be read
+ */
+int svcperm_load(const char *path,
+                 int (*lookup_uid)(const char *name, unsigned *uid));
+
+int svcperm_allowed(unsigned uid, const uint16_t *name, unsigned len);
+
+#endif
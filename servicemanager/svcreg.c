@@ -0,0 +1,122 @@
+/* Copyright 2008 The Android Open Source Project
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "svcreg.h"
+
+#define MIN_BUCKETS 64
+
+static struct svcinfo **buckets = 0;
+static unsigned bucket_mask = 0;
+
+/* registration order; LIST_SERVICES walks it backwards */
+static struct svcinfo **svcindex = 0;
+static unsigned svccount = 0;
+static unsigned svcindex_size = 0;
+
+/* FNV-1a over the UTF-16 code units */
+uint32_t svc_hash(const uint16_t *s16, unsigned len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--) {
+        h ^= *s16++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct svcinfo *find_svc(const uint16_t *s16, unsigned len)
+{
+    struct svcinfo *si;
+    uint32_t hash;
+
+    if (!buckets)
+        return 0;
+
+    hash = svc_hash(s16, len);
+    for (si = buckets[hash & bucket_mask]; si; si = si->next) {
+        if ((hash == si->hash) && (len == si->len) &&
+            !memcmp(s16, si->name, len * sizeof(uint16_t))) {
+            return si;
+        }
+    }
+    return 0;
+}
+
+static int grow_buckets(void)
+{
+    struct svcinfo **nb, *si;
+    unsigned size = buckets ? (bucket_mask + 1) * 2 : MIN_BUCKETS;
+    unsigned n;
+
+    nb = calloc(size, sizeof(*nb));
+    if (!nb)
+        return -1;
+
+    /* the ordered index holds every entry, so rehash from it */
+    for (n = 0; n < svccount; n++) {
+        si = svcindex[n];
+        si->next = nb[si->hash & (size - 1)];
+        nb[si->hash & (size - 1)] = si;
+    }
+    free(buckets);
+    buckets = nb;
+    bucket_mask = size - 1;
+    return 0;
+}
+
+static int grow_index(void)
+{
+    struct svcinfo **ni;
+    unsigned size = svcindex_size ? svcindex_size * 2 : MIN_BUCKETS;
+
+    ni = realloc(svcindex, size * sizeof(*ni));
+    if (!ni)
+        return -1;
+    svcindex = ni;
+    svcindex_size = size;
+    return 0;
+}
+
+struct svcinfo *svc_insert(const uint16_t *s16, unsigned len)
+{
+    struct svcinfo *si;
+    struct svcinfo **head;
+
+    /* keep the load factor under 3/4 */
+    if ((!buckets || (svccount + 1) * 4 > (bucket_mask + 1) * 3) &&
+        grow_buckets())
+        return 0;
+    if ((svccount == svcindex_size) && grow_index())
+        return 0;
+
+    si = malloc(sizeof(*si) + (len + 1) * sizeof(uint16_t));
+    if (!si)
+        return 0;
+    si->ptr = 0;
+    si->hash = svc_hash(s16, len);
+    si->len = len;
+    memcpy(si->name, s16, len * sizeof(uint16_t));
+    si->name[len] = '\0';
+
+    head = &buckets[si->hash & bucket_mask];
+    si->next = *head;
+    *head = si;
+    svcindex[svccount++] = si;
+    return si;
+}
+
+struct svcinfo *svc_at(unsigned n)
+{
+    if (n >= svccount)
+        return 0;
+    return svcindex[svccount - 1 - n];
+}
+
+unsigned svc_count(void)
+{
+    return svccount;
+}
@@ -0,0 +1,40 @@
+/* Copyright 2008 The Android Open Source Project
+ */
+
+#ifndef _SVCREG_H_
+#define _SVCREG_H_
+
+#include "binder.h"
+
+/* The service registry: every name ever added, hashed for lookup and
+ * kept in an ordered index for SVC_MGR_LIST_SERVICES.  Entries are
+ * never removed; a dead service keeps its slot with ptr == 0.  No
+ * locking here: lookups may run concurrently with each other, but not
+ * with svc_insert().
+ */
+struct svcinfo 
+{
+    struct svcinfo *next;      /* hash chain */
+    void *ptr;
+    struct binder_death death;
+    uint32_t hash;
+    unsigned len;
+    uint16_t name[0];
+};
+
+uint32_t svc_hash(const uint16_t *s16, unsigned len);
+
+struct svcinfo *find_svc(const uint16_t *s16, unsigned len);
+
+/* allocate and index a new entry; the caller has checked that the
+ * name is not registered yet
+ * - returns 0 when out of memory
+ */
+struct svcinfo *svc_insert(const uint16_t *s16, unsigned len);
+
+/* n-th entry in LIST_SERVICES order (newest first), or 0 */
+struct svcinfo *svc_at(unsigned n);
+
+unsigned svc_count(void);
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Binder asynchronous transaction test
+ *
+ * A forked server echoes values back after a delay.  The client checks that
+ * replies to IPCThreadState::transactAsync() (TF_TAGGED_REPLY) reach the
+ * right AsyncReply:
+ *
+ *   - two calls outstanding at once, answered out of order
+ *   - a call answered while the thread waits for an ordinary transact()
+ *   - a call answered while the issuing thread is in the thread pool
+ *   - a call to a target that dies before answering (BR_DEAD_TAGGED_REPLY)
+ *
+ * Exits with a non-zero status on the first mismatch, and with 0 (after
+ * saying so) if the driver cannot tag replies.
+ */
+
+#include <cerrno>
+#include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <binder/BpBinder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+#include <utils/threads.h>
+
+using namespace android;
+using namespace std;
+
+static String16 serviceName("test.binderAsync");
+
+static int failures;
+
+static void expect(bool cond, const char* what)
+{
+    if (!cond) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+class AsyncService : public BBinder
+{
+  public:
+    enum command {
+        ECHO = IBinder::FIRST_CALL_TRANSACTION,     // delay ms, value
+        DIE,                                        // delay ms
+    };
+
+    virtual status_t onTransact(uint32_t code,
+                                const Parcel& data, Parcel* reply,
+                                uint32_t flags = 0)
+    {
+        const int32_t delay = data.readInt32();
+        usleep(delay * 1000);
+
+        switch (code) {
+        case ECHO:
+            reply->writeInt32(data.readInt32());
+            return NO_ERROR;
+
+        case DIE:
+            _exit(0);
+
+        default:
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+    }
+};
+
+// Records the reply it is handed, for a thread other than the issuing one
+// to wait on.
+class SignalledReply : public AsyncReply
+{
+  public:
+    SignalledReply() : mValue(0), mSignalled(false) {}
+
+    bool waitSignalled(int32_t* value, nsecs_t timeout)
+    {
+        AutoMutex _l(mLock);
+        if (!mSignalled) mCondition.waitRelative(mLock, timeout);
+        *value = mValue;
+        return mSignalled;
+    }
+
+  protected:
+    virtual void onReply(status_t status, const Parcel& reply)
+    {
+        AutoMutex _l(mLock);
+        mValue = status == NO_ERROR ? reply.readInt32() : status;
+        mSignalled = true;
+        mCondition.signal();
+    }
+
+  private:
+    Mutex       mLock;
+    Condition   mCondition;
+    int32_t     mValue;
+    bool        mSignalled;
+};
+
+// Issues one call, then becomes a pool thread; the reply has to be picked
+// up from there.
+class PoolCaller : public Thread
+{
+  public:
+    PoolCaller(int32_t handle, const sp<AsyncReply>& reply)
+        : mHandle(handle), mReply(reply) {}
+
+  protected:
+    virtual bool threadLoop()
+    {
+        Parcel data;
+        data.writeInt32(100);
+        data.writeInt32(5);
+        IPCThreadState* ipc = IPCThreadState::self();
+        expect(ipc->transactAsync(mHandle, AsyncService::ECHO, data, mReply) == NO_ERROR,
+                "transactAsync from the pool thread");
+        ipc->joinThreadPool(true);
+        return false;
+    }
+
+  private:
+    const int32_t           mHandle;
+    const sp<AsyncReply>    mReply;
+};
+
+static status_t echoAsync(int32_t handle, int32_t delay, int32_t value,
+                          const sp<AsyncReply>& reply)
+{
+    Parcel data;
+    data.writeInt32(delay);
+    data.writeInt32(value);
+    return IPCThreadState::self()->transactAsync(handle, AsyncService::ECHO, data, reply);
+}
+
+static void server(void)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+    if (sm->addService(serviceName, new AsyncService()) != NO_ERROR) {
+        cerr << "addService " << serviceName << " failed" << endl;
+        _exit(2);
+    }
+    proc->startThreadPool();
+    IPCThreadState::self()->joinThreadPool();
+}
+
+static int client(void)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IBinder> binder = defaultServiceManager()->getService(serviceName);
+    if (binder == NULL || binder->remoteBinder() == NULL) {
+        cerr << serviceName << " not published" << endl;
+        return 2;
+    }
+    const int32_t handle = binder->remoteBinder()->handle();
+    IPCThreadState* ipc = IPCThreadState::self();
+
+    // Two outstanding calls, the second answered first.
+    sp<AsyncReply> slow = new AsyncReply();
+    sp<AsyncReply> fast = new AsyncReply();
+    status_t err = echoAsync(handle, 300, 1, slow);
+    if (err == INVALID_OPERATION) {
+        cout << "binderAsync: driver can't tag replies, skipped" << endl;
+        return 0;
+    }
+    expect(err == NO_ERROR, "transactAsync (slow)");
+    expect(echoAsync(handle, 50, 2, fast) == NO_ERROR, "transactAsync (fast)");
+    expect(fast->wait() == NO_ERROR && fast->reply().readInt32() == 2, "fast reply");
+    expect(ipc->waitForAsyncReplies() == NO_ERROR, "waitForAsyncReplies");
+    expect(slow->isDone() && slow->status() == NO_ERROR
+            && slow->reply().readInt32() == 1, "slow reply");
+
+    // One answered while the thread waits for an ordinary transact().
+    sp<AsyncReply> pending = new AsyncReply();
+    expect(echoAsync(handle, 100, 3, pending) == NO_ERROR, "transactAsync (pending)");
+    Parcel data, reply;
+    data.writeInt32(400);
+    data.writeInt32(4);
+    expect(binder->transact(AsyncService::ECHO, data, &reply) == NO_ERROR
+            && reply.readInt32() == 4, "transact with a call outstanding");
+    expect(pending->isDone() && pending->reply().readInt32() == 3,
+            "reply delivered during transact()");
+
+    // One answered while the issuing thread is in the pool.
+    sp<SignalledReply> pooled = new SignalledReply();
+    sp<PoolCaller> caller = new PoolCaller(handle, pooled);
+    caller->run("PoolCaller");
+    int32_t value;
+    expect(pooled->waitSignalled(&value, seconds(5)) && value == 5,
+            "reply delivered in the thread pool");
+
+    // A target that dies with the call outstanding.
+    sp<AsyncReply> dead = new AsyncReply();
+    data.freeData();
+    data.writeInt32(200);
+    expect(ipc->transactAsync(handle, AsyncService::DIE, data, dead) == NO_ERROR,
+            "transactAsync (dying target)");
+    expect(dead->wait() == DEAD_OBJECT, "reply from a dead target");
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    switch (pid) {
+    case 0:
+        server();
+        return 0;
+
+    case -1:
+        cerr << "fork failed, errno: " << errno << endl;
+        return 9;
+    }
+
+    int rv = client();
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    if (rv != 0) return rv;
+    if (failures) {
+        cerr << failures << " failure(s)" << endl;
+        return 1;
+    }
+    cout << "binderAsync: OK" << endl;
+    return 0;
+}
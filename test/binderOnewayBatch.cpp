@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Binder oneway batching test
+ *
+ * A forked, single-threaded server records the values of the oneway calls
+ * it receives.  The client sends them between beginOnewayBatch() and
+ * endOnewayBatch() and checks that:
+ *
+ *   - a two-way call made inside a batch sees every oneway queued before it
+ *   - a batch is handed over once MAX_ONEWAY_BATCH calls are queued, and
+ *     held until then
+ *   - a oneway to a dead target fails the batch without upsetting the
+ *     calls around it, the two-way call that follows, or a later oneway
+ *
+ * Exits with a non-zero status on the first mismatch.
+ */
+
+#include <cerrno>
+#include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <binder/BpBinder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+using namespace android;
+using namespace std;
+
+static String16 serviceName("test.binderOnewayBatch");
+static String16 victimName("test.binderOnewayBatch.victim");
+
+static int failures;
+
+static void expect(bool cond, const char* what)
+{
+    if (!cond) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+class RecordService : public BBinder
+{
+  public:
+    enum command {
+        RECORD = IBinder::FIRST_CALL_TRANSACTION,   // oneway: value
+        GET_LOG,                                    // returns count, values
+        CLEAR,
+    };
+
+    virtual status_t onTransact(uint32_t code,
+                                const Parcel& data, Parcel* reply,
+                                uint32_t flags = 0)
+    {
+        switch (code) {
+        case RECORD:
+            mLog.add(data.readInt32());
+            return NO_ERROR;
+
+        case GET_LOG:
+            reply->writeInt32(mLog.size());
+            for (size_t i = 0; i < mLog.size(); i++) {
+                reply->writeInt32(mLog[i]);
+            }
+            return NO_ERROR;
+
+        case CLEAR:
+            mLog.clear();
+            return NO_ERROR;
+
+        default:
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+    }
+
+  private:
+    // Only ever touched from the one binder thread.
+    Vector<int32_t> mLog;
+};
+
+static void server(const String16& name)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    if (defaultServiceManager()->addService(name, new RecordService()) != NO_ERROR) {
+        cerr << "addService " << name << " failed" << endl;
+        _exit(2);
+    }
+    // No thread pool: calls are served one at a time, in arrival order.
+    IPCThreadState::self()->joinThreadPool();
+}
+
+static pid_t startServer(const String16& name)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        server(name);
+        _exit(0);
+    }
+    return pid;
+}
+
+static int32_t handleOf(const sp<IBinder>& binder)
+{
+    return binder->remoteBinder()->handle();
+}
+
+static status_t record(int32_t handle, int32_t value)
+{
+    Parcel data;
+    data.writeInt32(value);
+    return IPCThreadState::self()->transact(handle, RecordService::RECORD,
+            data, NULL, IBinder::FLAG_ONEWAY);
+}
+
+// The values recorded so far, in order; false if the call failed.
+static bool getLog(int32_t handle, Vector<int32_t>* log)
+{
+    Parcel data, reply;
+    if (IPCThreadState::self()->transact(handle, RecordService::GET_LOG,
+            data, &reply, 0) != NO_ERROR) {
+        return false;
+    }
+    log->clear();
+    const int32_t n = reply.readInt32();
+    for (int32_t i = 0; i < n; i++) {
+        log->add(reply.readInt32());
+    }
+    return true;
+}
+
+static bool isSequence(const Vector<int32_t>& log, int32_t count)
+{
+    if (log.size() != (size_t)count) return false;
+    for (int32_t i = 0; i < count; i++) {
+        if (log[i] != i) return false;
+    }
+    return true;
+}
+
+static void clearLog(int32_t handle)
+{
+    Parcel data, reply;
+    IPCThreadState::self()->transact(handle, RecordService::CLEAR, data, &reply, 0);
+}
+
+// Asks for the log from a thread of its own, which isn't in the batch.
+class LogReader : public Thread
+{
+  public:
+    LogReader(int32_t handle) : mHandle(handle), mOk(false) {}
+    Vector<int32_t> mLog;
+
+    bool ok() const { return mOk; }
+
+  protected:
+    virtual bool threadLoop()
+    {
+        mOk = getLog(mHandle, &mLog);
+        return false;
+    }
+
+  private:
+    const int32_t mHandle;
+    bool mOk;
+};
+
+static size_t countFromOtherThread(int32_t handle)
+{
+    usleep(200 * 1000);     // anything sent has arrived by now
+    sp<LogReader> reader = new LogReader(handle);
+    reader->run("LogReader");
+    reader->join();
+    return reader->ok() ? reader->mLog.size() : (size_t)-1;
+}
+
+static void testOrdering(int32_t handle)
+{
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int32_t N = 10;
+
+    clearLog(handle);
+    ipc->beginOnewayBatch();
+    for (int32_t i = 0; i < N; i++) {
+        expect(record(handle, i) == NO_ERROR, "queue oneway");
+    }
+    Vector<int32_t> log;
+    expect(getLog(handle, &log) && isSequence(log, N),
+            "two-way call in a batch sees the oneways before it");
+    expect(ipc->endOnewayBatch() == NO_ERROR, "endOnewayBatch");
+}
+
+static void testFlush(int32_t handle)
+{
+    IPCThreadState* ipc = IPCThreadState::self();
+    const int32_t N = IPCThreadState::MAX_ONEWAY_BATCH;
+
+    clearLog(handle);
+    ipc->beginOnewayBatch();
+    for (int32_t i = 0; i < N; i++) {
+        record(handle, i);
+    }
+    expect(countFromOtherThread(handle) == (size_t)N,
+            "a full batch is sent without endOnewayBatch()");
+    record(handle, N);
+    expect(countFromOtherThread(handle) == (size_t)N,
+            "the next oneway waits for the batch to end");
+    expect(ipc->endOnewayBatch() == NO_ERROR, "endOnewayBatch after a flush");
+
+    Vector<int32_t> log;
+    expect(getLog(handle, &log) && isSequence(log, N + 1), "all oneways arrive in order");
+}
+
+static void testDeadTarget(int32_t handle, int32_t deadHandle)
+{
+    IPCThreadState* ipc = IPCThreadState::self();
+
+    clearLog(handle);
+    ipc->beginOnewayBatch();
+    record(handle, 0);
+    record(deadHandle, 100);
+    record(handle, 1);
+    expect(ipc->endOnewayBatch() != NO_ERROR, "batch with a dead target fails");
+
+    Vector<int32_t> log;
+    expect(getLog(handle, &log) && isSequence(log, 2),
+            "two-way call after the failed batch");
+
+    // Must not swallow this one's completion or block.
+    expect(record(handle, 2) == NO_ERROR, "oneway after the failed batch");
+    expect(getLog(handle, &log) && isSequence(log, 3), "log after the failed batch");
+}
+
+int main(int argc, char *argv[])
+{
+    pid_t serverPid = startServer(serviceName);
+    pid_t victimPid = startServer(victimName);
+    if (serverPid < 0 || victimPid < 0) {
+        cerr << "fork failed, errno: " << errno << endl;
+        return 9;
+    }
+
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+    sp<IBinder> service = sm->getService(serviceName);
+    sp<IBinder> victim = sm->getService(victimName);
+    if (service == NULL || victim == NULL) {
+        cerr << "services not published" << endl;
+        kill(serverPid, SIGTERM);
+        kill(victimPid, SIGTERM);
+        return 2;
+    }
+
+    testOrdering(handleOf(service));
+    testFlush(handleOf(service));
+
+    kill(victimPid, SIGKILL);
+    waitpid(victimPid, NULL, 0);
+    testDeadTarget(handleOf(service), handleOf(victim));
+
+    kill(serverPid, SIGTERM);
+    waitpid(serverPid, NULL, 0);
+
+    if (failures) {
+        cerr << failures << " failure(s)" << endl;
+        return 1;
+    }
+    cout << "binderOnewayBatch: OK" << endl;
+    return 0;
+}
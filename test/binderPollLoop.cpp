@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Binder event loop benchmark
+ *
+ * A sample of serving binder calls from a single-threaded epoll loop,
+ * timed against the usual way of doing it.  The service keeps its state
+ * on the loop thread, as event-driven services do.
+ *
+ *   pool mode (default): calls arrive on thread pool threads, which hand
+ *       each one over to the loop thread and wait for the result.
+ *   poll mode (-p): the loop thread polls the binder descriptor itself
+ *       (IPCThreadState::setupPolling()) and runs the calls directly.
+ *
+ * The loop also runs a 1 ms timer, standing in for the rest of the work an
+ * event loop does.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -p     - serve from the epoll loop instead of the thread pool
+ *   -n num - perform IPC operation num times (default: 10000)
+ */
+
+#include <cerrno>
+#include <iostream>
+#include <libgen.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+#include <utils/threads.h>
+
+using namespace android;
+using namespace std;
+
+static String16 serviceName("test.binderPollLoop");
+
+static struct options {
+    bool poll;
+    unsigned int iterations;
+} options = {
+    false,  // Thread pool
+    10000,  // Iterations
+};
+
+enum {
+    ADD_INTS = IBinder::FIRST_CALL_TRANSACTION,
+};
+
+// State owned by the loop thread
+static int64_t gTotal;
+static unsigned int gTicks;
+
+static int32_t addInts(int32_t val1, int32_t val2)
+{
+    gTotal += val1 + val2;
+    return val1 + val2;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Thread pool mode: a call handed over to the loop thread.
+class Handoff
+{
+  public:
+    Handoff() : mEventFd(eventfd(0, EFD_NONBLOCK)), mPending(false) {}
+
+    int fd() const { return mEventFd; }
+
+    // Called on a thread pool thread
+    int32_t call(int32_t val1, int32_t val2) {
+        Mutex::Autolock _l(mCallLock);  // one call in flight at a time
+        Mutex::Autolock _d(mLock);
+        mArgs[0] = val1;
+        mArgs[1] = val2;
+        mPending = true;
+        uint64_t one = 1;
+        write(mEventFd, &one, sizeof(one));
+        while (mPending) mDone.wait(mLock);
+        return mResult;
+    }
+
+    // Called on the loop thread when fd() is readable
+    void run() {
+        uint64_t count;
+        read(mEventFd, &count, sizeof(count));
+        Mutex::Autolock _l(mLock);
+        if (mPending) {
+            mResult = addInts(mArgs[0], mArgs[1]);
+            mPending = false;
+            mDone.signal();
+        }
+    }
+
+  private:
+    const int mEventFd;
+    Mutex mCallLock;
+    Mutex mLock;
+    Condition mDone;
+    bool mPending;
+    int32_t mArgs[2];
+    int32_t mResult;
+};
+
+static Handoff* gHandoff;
+
+class AddIntsService : public BBinder
+{
+  public:
+    virtual status_t onTransact(uint32_t code, const Parcel& data,
+                                Parcel* reply, uint32_t flags = 0) {
+        if (code != ADD_INTS) {
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+        int32_t val1 = data.readInt32();
+        int32_t val2 = data.readInt32();
+        reply->writeInt32(options.poll ? addInts(val1, val2)
+                                       : gHandoff->call(val1, val2));
+        return NO_ERROR;
+    }
+};
+
+static void server(void)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    int epfd = epoll_create(4);
+    struct epoll_event ev;
+    int binderFd = -1;
+
+    if (options.poll) {
+        status_t err = IPCThreadState::self()->setupPolling(&binderFd);
+        if (err != NO_ERROR) {
+            cerr << "setupPolling failed, err: " << err << endl;
+            exit(10);
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = binderFd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, binderFd, &ev);
+    } else {
+        gHandoff = new Handoff();
+        ev.events = EPOLLIN;
+        ev.data.fd = gHandoff->fd();
+        epoll_ctl(epfd, EPOLL_CTL_ADD, gHandoff->fd(), &ev);
+    }
+
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec tick = { { 0, 1000000 }, { 0, 1000000 } };
+    timerfd_settime(timerFd, 0, &tick, NULL);
+    ev.events = EPOLLIN;
+    ev.data.fd = timerFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev);
+
+    defaultServiceManager()->addService(serviceName, new AddIntsService());
+    if (!options.poll) {
+        proc->startThreadPool();
+    }
+
+    struct epoll_event events[4];
+    while (true) {
+        int n = epoll_wait(epfd, events, 4, -1);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == timerFd) {
+                uint64_t expired;
+                read(timerFd, &expired, sizeof(expired));
+                gTicks += expired;
+            } else if (fd == binderFd) {
+                IPCThreadState::self()->handlePolledCommands();
+            } else {
+                gHandoff->run();
+            }
+        }
+    }
+}
+
+static void client(void)
+{
+    sp<IServiceManager> sm = defaultServiceManager();
+    double min = -1, max = 0.0, total = 0.0;
+
+    sp<IBinder> binder;
+    do {
+        binder = sm->getService(serviceName);
+        if (binder != 0) break;
+        cout << serviceName << " not published, waiting..." << endl;
+        usleep(500000); // 0.5 s
+    } while (true);
+
+    for (unsigned int iter = 0; iter < options.iterations; iter++) {
+        Parcel send, reply;
+        send.writeInt32(iter);
+        send.writeInt32(iter + 3);
+
+        double start = now();
+        status_t rv = binder->transact(ADD_INTS, send, &reply);
+        double delta = now() - start;
+        if (rv != NO_ERROR) {
+            cerr << "binder->transact failed, rv: " << rv << endl;
+            exit(20);
+        }
+        if (reply.readInt32() != (int32_t) (iter + iter + 3)) {
+            cerr << "Unexpected result for iteration " << iter << endl;
+        }
+
+        min = (min < 0 || delta < min) ? delta : min;
+        max = (delta > max) ? delta : max;
+        total += delta;
+    }
+
+    cout << "Time per iteration min: " << min
+        << " avg: " << (total / options.iterations)
+        << " max: " << max
+        << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "pn:?")) != -1) {
+        switch (opt) {
+        case 'p':
+            options.poll = true;
+            break;
+
+        case 'n':
+            options.iterations = strtoul(optarg, NULL, 10);
+            if (options.iterations < 1) {
+                cerr << "Less than 1 iteration specified by: "
+                    << optarg << endl;
+                exit(1);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -p - serve from an epoll loop" << endl;
+            cerr << "    -n num - iterations" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 2);
+        }
+    }
+
+    cout << "mode: " << (options.poll ? "epoll loop" : "thread pool + handoff")
+        << endl;
+    cout << "iterations: " << options.iterations << endl;
+
+    // Fork the server, use this process as the client
+    fflush(stdout);
+    pid_t pid = fork();
+    switch (pid) {
+    case 0:
+        server();
+        return 0;
+
+    case -1:
+        exit(3);
+
+    default:
+        client();
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return 0;
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Service manager lookup test
+ *
+ * Publishes a service, then looks it up together with names that are not
+ * registered, through checkService() and the batched checkServices().
+ * Registered names must come back as the published service and missing
+ * names as NULL, never as the service manager itself.
+ *
+ * Exits with a non-zero status on the first mismatch.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+
+using namespace android;
+using namespace std;
+
+static String16 serviceName("test.checkServices");
+
+static int failures;
+
+static void expect(bool cond, const char* what)
+{
+    if (!cond) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+    sp<IBinder> service = new BBinder();
+
+    if (sm->addService(serviceName, service) != NO_ERROR) {
+        cerr << "addService failed" << endl;
+        return 2;
+    }
+    sp<IBinder> manager = sm->asBinder();
+
+    expect(sm->checkService(serviceName) == service,
+           "checkService() of a registered name");
+    expect(sm->checkService(String16("test.checkServices.missing")) == 0,
+           "checkService() of a missing name");
+
+    Vector<String16> names;
+    names.add(String16("test.checkServices.missing"));
+    names.add(serviceName);
+    names.add(String16("test.checkServices.missing2"));
+    // Long enough to be split over more than one transaction
+    for (int i = 0; i < IServiceManager::MAX_CHECK_SERVICES; i++) {
+        names.add(String16("test.checkServices.filler"));
+    }
+    names.add(serviceName);
+
+    Vector< sp<IBinder> > found = sm->checkServices(names);
+    expect(found.size() == names.size(), "checkServices() result size");
+    if (found.size() == names.size()) {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == serviceName) {
+                expect(found[i] == service, "registered name in checkServices()");
+            } else {
+                expect(found[i] == 0, "missing name in checkServices()");
+                expect(found[i] != manager,
+                       "missing name read back as the service manager");
+            }
+        }
+    }
+
+    cout << (failures ? "FAILED" : "PASSED") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * IPCThreadState::self() benchmark
+ *
+ * Measures the per-call cost of getting at the calling thread's binder
+ * state, which every transaction, getCallingUid() and RPC header read or
+ * write pays, next to a bare pthread_getspecific() for reference.  Needs
+ * the binder driver.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -n num - time each operation num times (default: 10000000)
+ */
+
+#include <iostream>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/Parcel.h>
+
+using namespace android;
+using namespace std;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* what, double elapsed, unsigned int iterations)
+{
+    cout << "  " << what << ": " << elapsed / iterations * 1e9 << " ns" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int iterations = 10000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:?")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+
+        case '?':
+        default:
+            cerr << "Usage: " << argv[0] << " [-n num]" << endl;
+            exit(1);
+        }
+    }
+
+    pthread_key_t key;
+    pthread_key_create(&key, NULL);
+    pthread_setspecific(key, &key);
+    IPCThreadState::self();
+
+    cout << "iterations: " << iterations << endl;
+
+    uintptr_t check = 0;
+    double start = now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        check += (uintptr_t) pthread_getspecific(key);
+    }
+    report("pthread_getspecific", now() - start, iterations);
+
+    start = now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        check += (uintptr_t) IPCThreadState::self();
+    }
+    report("IPCThreadState::self", now() - start, iterations);
+
+    start = now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        check += IPCThreadState::self()->getCallingUid();
+    }
+    report("getCallingUid", now() - start, iterations);
+
+    // The RPC header both ways, as on every proxy call and its stub.
+    const unsigned int parcels = iterations / 10;
+    const String16& descriptor(IServiceManager::descriptor);
+    start = now();
+    for (unsigned int i = 0; i < parcels; i++) {
+        Parcel data;
+        data.writeInterfaceToken(descriptor);
+        data.setDataPosition(0);
+        check += data.enforceInterface(descriptor);
+    }
+    report("writeInterfaceToken + enforceInterface", now() - start, parcels);
+
+    if (check == 0) cout << "(no output)" << endl;
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+/*
+ * Fills the context manager's binder mapping and checks that transactions
+ * which don't fit stay queued, intact and in order, until buffers are freed.
+ *
+ * The manager maps 16K split into four 4K buffers and doesn't free what it
+ * reads; a client sends it NUM_TXNS oneway transactions of TXN_SIZE bytes.
+ */
+
+#define MAP_SIZE	(16 * 1024)
+#define BUF_SIZE	4096
+#define NUM_BUFS	(MAP_SIZE / BUF_SIZE)
+#define NUM_TXNS	(2 * NUM_BUFS)
+#define TXN_SIZE	2048
+
+
+static unsigned char payload[NUM_TXNS][TXN_SIZE];
+
+
+int send_transactions(void)
+{
+	int fd, i, r;
+	struct binder_write_read bwr;
+	unsigned char wbuf[NUM_TXNS * (sizeof(uint32_t) + sizeof(struct binder_transaction_data))];
+	unsigned char *p = wbuf;
+	struct binder_transaction_data tdata;
+	uint32_t cmd = BC_TRANSACTION;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open binder device\n");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_TXNS; i++) {
+		memset(payload[i], i + 1, TXN_SIZE);
+
+		memset(&tdata, 0, sizeof(tdata));
+		tdata.target.handle = 0;
+		tdata.code = i;
+		tdata.flags = TF_ONE_WAY;
+		tdata.data_size = TXN_SIZE;
+		tdata.offsets_size = 0;
+		tdata.data.ptr.buffer = payload[i];
+		tdata.data.ptr.offsets = NULL;
+
+		memcpy(p, &cmd, sizeof(cmd));
+		p += sizeof(cmd);
+		memcpy(p, &tdata, sizeof(tdata));
+		p += sizeof(tdata);
+	}
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = p - wbuf;
+
+	r = ioctl(fd, BINDER_WRITE_READ, &bwr);
+	if (r < 0) {
+		fprintf(stderr, "Failed to write transactions: %d\n", errno);
+		return -1;
+	}
+
+	// stay around so the driver has no reason to drop the queued work
+	pause();
+	return 0;
+}
+
+int free_buffer(int fd, void *buffer)
+{
+	struct binder_write_read bwr;
+	unsigned char wbuf[sizeof(uint32_t) + sizeof(void *)];
+	uint32_t cmd = BC_FREE_BUFFER;
+
+	memcpy(wbuf, &cmd, sizeof(cmd));
+	memcpy(wbuf + sizeof(cmd), &buffer, sizeof(buffer));
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = sizeof(wbuf);
+
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		fprintf(stderr, "Failed to free buffer %p: %d\n", buffer, errno);
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns 1 and the transaction read, 0 when the mapping is full, or -1. */
+int read_transaction(int fd, struct binder_transaction_data *tdata)
+{
+	struct binder_write_read bwr;
+	unsigned char rbuf[256], *p, *ep;
+	uint32_t cmd;
+
+	while (1) {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_buffer = (unsigned long)rbuf;
+		bwr.read_size = sizeof(rbuf);
+
+		if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == ENOBUFS)
+				return 0;
+			fprintf(stderr, "Failed to read command: %d\n", errno);
+			return -1;
+		}
+
+		p = rbuf;
+		ep = p + bwr.read_consumed;
+		while (p + sizeof(cmd) <= ep) {
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+
+			switch (cmd) {
+				case BR_NOOP:
+				case BR_SPAWN_LOOPER:
+					break;
+
+				case BR_TRANSACTION:
+					if (p + sizeof(*tdata) > ep) {
+						fprintf(stderr, "not enough transaction data\n");
+						return -1;
+					}
+					memcpy(tdata, p, sizeof(*tdata));
+					return 1;
+
+				default:
+					fprintf(stderr, "rcv unexpected command: %u\n", cmd);
+					return -1;
+			}
+		}
+	}
+}
+
+int check_transaction(struct binder_transaction_data *tdata, int n)
+{
+	const unsigned char *data = tdata->data.ptr.buffer;
+	int i;
+
+	if (tdata->code != n || tdata->data_size != TXN_SIZE) {
+		fprintf(stderr, "expected transaction %d, got %u (%lu bytes)\n",
+			n, tdata->code, (unsigned long)tdata->data_size);
+		return -1;
+	}
+	for (i = 0; i < TXN_SIZE; i++) {
+		if (data[i] != (unsigned char)(n + 1)) {
+			fprintf(stderr, "transaction %d corrupted at byte %d\n", n, i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int fd, i, r, next = 0, result = -1;
+	struct binder_mmap_geometry g;
+	struct binder_transaction_data tdata;
+	void *held[NUM_BUFS];
+	void *map;
+	pid_t pid;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open binder device\n");
+		return -1;
+	}
+
+	g.max_alloc_size = BUF_SIZE;
+	g.alloc_size_shift = 1;
+	g.num_buckets = 1;
+	if (ioctl(fd, BINDER_SET_MMAP_GEOMETRY, &g) < 0) {
+		fprintf(stderr, "Failed to set mmap geometry: %d\n", errno);
+		return -1;
+	}
+
+	map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map binder device: %d\n", errno);
+		return -1;
+	}
+
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		fprintf(stderr, "Failed to become context manager\n");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "Failed to fork: %d\n", errno);
+		return -1;
+	}
+	if (!pid)
+		return send_transactions() < 0 ? 1 : 0;
+
+	// fill the mapping without freeing anything
+	for (i = 0; i < NUM_BUFS; i++) {
+		if (read_transaction(fd, &tdata) != 1 || check_transaction(&tdata, next++) < 0)
+			goto out;
+		held[i] = (void *)tdata.data.ptr.buffer;
+	}
+
+	// the rest must stay queued rather than be dropped or freed
+	while (next < NUM_TXNS) {
+		r = read_transaction(fd, &tdata);
+		if (r != 0) {
+			fprintf(stderr, "read with a full mapping returned %d, expected ENOBUFS\n", r);
+			goto out;
+		}
+
+		i = next % NUM_BUFS;
+		if (free_buffer(fd, held[i]) < 0)
+			goto out;
+
+		if (read_transaction(fd, &tdata) != 1 || check_transaction(&tdata, next++) < 0)
+			goto out;
+		held[i] = (void *)tdata.data.ptr.buffer;
+	}
+
+	printf("mmap_full: %d transactions through %d buffers OK\n", NUM_TXNS, NUM_BUFS);
+	result = 0;
+
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return result;
+}
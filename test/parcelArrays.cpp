@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Parcel typed array test
+ *
+ * Round-trips arrays through the write*Array() / read*Array() calls and
+ * checks the in-place reads: a pointer to the elements when they are
+ * aligned, NULL with nothing consumed when they are not (int64 behind an
+ * odd number of int32s), and NULL for a malformed length.
+ *
+ * Exits with a non-zero status on the first mismatch.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+
+using namespace android;
+using namespace std;
+
+static const size_t N = 100;
+
+static int failures;
+
+static void expect(bool cond, const char* what)
+{
+    if (!cond) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+static void testRoundTrip()
+{
+    int32_t i32[N];
+    int64_t i64[N];
+    float f[N];
+    double d[N];
+    for (size_t i = 0; i < N; i++) {
+        i32[i] = (int32_t)i - 50;
+        i64[i] = ((int64_t)i << 40) + i;
+        f[i] = i / 4.0f;
+        d[i] = i / 8.0;
+    }
+
+    Parcel p;
+    expect(p.writeInt32Array(N, i32) == NO_ERROR, "writeInt32Array");
+    expect(p.writeInt64Array(N, i64) == NO_ERROR, "writeInt64Array");
+    expect(p.writeFloatArray(N, f) == NO_ERROR, "writeFloatArray");
+    expect(p.writeDoubleArray(N, d) == NO_ERROR, "writeDoubleArray");
+    expect(p.writeInt32Array(0, NULL) == NO_ERROR, "empty array");
+    p.writeInt32(12345);
+    expect(p.dataSize() == 5 * sizeof(int32_t) + N * (4 + 8 + 4 + 8) + sizeof(int32_t),
+            "array wire size");
+
+    int32_t ri32[N];
+    int64_t ri64[N];
+    float rf[N];
+    double rd[N];
+    size_t len;
+    p.setDataPosition(0);
+
+    len = N;
+    expect(p.readInt32Array(ri32, &len) == NO_ERROR && len == N
+            && !memcmp(ri32, i32, sizeof(i32)), "readInt32Array");
+    len = N;
+    expect(p.readInt64Array(ri64, &len) == NO_ERROR && len == N
+            && !memcmp(ri64, i64, sizeof(i64)), "readInt64Array");
+    len = N;
+    expect(p.readFloatArray(rf, &len) == NO_ERROR && len == N
+            && !memcmp(rf, f, sizeof(f)), "readFloatArray");
+    len = N;
+    expect(p.readDoubleArray(rd, &len) == NO_ERROR && len == N
+            && !memcmp(rd, d, sizeof(d)), "readDoubleArray");
+    len = N;
+    expect(p.readInt32Array(ri32, &len) == NO_ERROR && len == 0, "read empty array");
+    expect(p.readInt32() == 12345, "value after the arrays");
+}
+
+static void testTooSmall()
+{
+    int32_t v[N] = { 0 };
+    Parcel p;
+    p.writeInt32Array(N, v);
+    p.setDataPosition(0);
+
+    int32_t out[N / 2];
+    size_t len = N / 2;
+    expect(p.readInt32Array(out, &len) == BAD_VALUE, "short buffer is BAD_VALUE");
+    expect(p.dataPosition() == 0, "short buffer consumes nothing");
+}
+
+static void testInplace()
+{
+    int32_t i32[N];
+    int64_t i64[N];
+    for (size_t i = 0; i < N; i++) {
+        i32[i] = i;
+        i64[i] = -(int64_t)i;
+    }
+
+    Parcel p;
+    p.writeInt32Array(N, i32);
+    p.writeInt64Array(N, i64);
+    p.setDataPosition(0);
+
+    size_t len = 0;
+    const int32_t* r32 = p.readInt32ArrayInplace(&len);
+    expect(r32 != NULL && len == N && !memcmp(r32, i32, sizeof(i32)),
+            "readInt32ArrayInplace");
+
+    // The int64 elements follow 1 + N + 1 int32s, so whether they are
+    // 8-byte aligned depends on the parcel's buffer.  Either way the
+    // elements must come back.
+    const size_t pos = p.dataPosition();
+    const int64_t* r64 = p.readInt64ArrayInplace(&len);
+    if (r64 != NULL) {
+        expect(len == N && !memcmp(r64, i64, sizeof(i64)), "readInt64ArrayInplace");
+    } else {
+        expect(p.dataPosition() == pos, "unaligned in-place read consumes nothing");
+        int64_t out[N];
+        len = N;
+        expect(p.readInt64Array(out, &len) == NO_ERROR && len == N
+                && !memcmp(out, i64, sizeof(i64)), "copying read after in-place miss");
+    }
+
+    // One int32 more shifts the int64 elements by 4 bytes: exactly one of
+    // the two layouts can be read in place.
+    Parcel q;
+    q.writeInt32(0);
+    q.writeInt64Array(N, i64);
+    q.setDataPosition(sizeof(int32_t));
+    const bool shifted = q.readInt64ArrayInplace(&len) != NULL;
+    Parcel r;
+    r.writeInt64Array(N, i64);
+    r.setDataPosition(0);
+    const bool unshifted = r.readInt64ArrayInplace(&len) != NULL;
+    expect(shifted != unshifted, "int64 in place only when 8-byte aligned");
+}
+
+static void testMalformed()
+{
+    Parcel p;
+    p.writeInt32(1000);         // claims more elements than follow
+    p.writeInt32(1);
+    p.setDataPosition(0);
+
+    size_t len;
+    expect(p.readInt32ArrayInplace(&len) == NULL, "length past the end");
+    int32_t out[1000];
+    len = 1000;
+    expect(p.readInt32Array(out, &len) != NO_ERROR, "copying read of a bad length");
+
+    Parcel q;
+    q.writeInt32(-1);
+    q.setDataPosition(0);
+    expect(q.readInt32ArrayInplace(&len) == NULL, "negative length");
+}
+
+int main(int argc, char *argv[])
+{
+    testRoundTrip();
+    testTooSmall();
+    testInplace();
+    testMalformed();
+
+    if (failures) {
+        cerr << failures << " failure(s)" << endl;
+        return 1;
+    }
+    cout << "parcelArrays: OK" << endl;
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Segmented Parcel test
+ *
+ * Writes parcels large enough to span many segments (setSegmentSize())
+ * and checks that everything that joins them - reading, seeking, data(),
+ * appendFrom(), writing an object and turning segmenting off - sees the
+ * data exactly as written.
+ *
+ * Exits with a non-zero status on the first mismatch.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <binder/Binder.h>
+#include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+
+using namespace android;
+using namespace std;
+
+static const size_t SEGMENT_SIZE = 4096;
+static const int32_t NUM_INTS = 64 * 1024;      // 256K, 64 segments
+
+static int failures;
+
+static void expect(bool cond, const char* what)
+{
+    if (!cond) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+static void writeInts(Parcel& p, int32_t first, int32_t count)
+{
+    for (int32_t i = 0; i < count; i++) {
+        p.writeInt32(first + i);
+    }
+}
+
+static bool readInts(const Parcel& p, int32_t first, int32_t count)
+{
+    for (int32_t i = 0; i < count; i++) {
+        if (p.readInt32() != first + i) return false;
+    }
+    return true;
+}
+
+static void testReadBack()
+{
+    Parcel p;
+    expect(p.setSegmentSize(SEGMENT_SIZE) == NO_ERROR, "setSegmentSize");
+    writeInts(p, 0, NUM_INTS);
+    expect(p.dataSize() == NUM_INTS * sizeof(int32_t), "segmented dataSize");
+
+    p.setDataPosition(0);
+    expect(readInts(p, 0, NUM_INTS), "segmented read back");
+    expect(p.errorCheck() == NO_ERROR, "segmented errorCheck");
+
+    // After a seek into the middle of what were several segments.
+    p.setDataPosition((NUM_INTS / 2 + 3) * sizeof(int32_t));
+    expect(readInts(p, NUM_INTS / 2 + 3, 16), "read after seek");
+}
+
+static void testData()
+{
+    Parcel p;
+    p.setSegmentSize(SEGMENT_SIZE);
+
+    // Byte runs that straddle segment boundaries.
+    uint8_t buf[3000];
+    for (int n = 0; n < 100; n++) {
+        memset(buf, n, sizeof(buf));
+        p.write(buf, sizeof(buf));
+    }
+    const uint8_t* data = p.data();
+    expect(data != NULL, "data() of a segmented parcel");
+    if (data == NULL) return;
+    bool same = true;
+    for (int n = 0; n < 100 && same; n++) {
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            if (data[n * sizeof(buf) + i] != n) {
+                same = false;
+                break;
+            }
+        }
+    }
+    expect(same, "data() contents");
+}
+
+static void testAppendFrom()
+{
+    Parcel src, dst;
+    src.setSegmentSize(SEGMENT_SIZE);
+    writeInts(src, 0, NUM_INTS);
+
+    dst.setSegmentSize(SEGMENT_SIZE);
+    dst.writeInt32(-1);
+    expect(dst.appendFrom(&src, 0, src.dataSize()) == NO_ERROR, "appendFrom");
+    dst.setDataPosition(0);
+    expect(dst.readInt32() == -1, "appendFrom keeps what was there");
+    expect(readInts(dst, 0, NUM_INTS), "appendFrom contents");
+}
+
+static void testObject()
+{
+    sp<IBinder> binder = new BBinder();
+    Parcel p;
+    p.setSegmentSize(SEGMENT_SIZE);
+    writeInts(p, 0, NUM_INTS);
+
+    // An object is found by its offset, so this joins the segments.
+    expect(p.writeStrongBinder(binder) == NO_ERROR, "writeStrongBinder");
+    p.writeInt32(NUM_INTS);
+    expect(p.objectsCount() == 1, "object recorded");
+
+    p.setDataPosition(0);
+    expect(readInts(p, 0, NUM_INTS), "ints before the object");
+    expect(p.readStrongBinder() == binder, "object read back");
+    expect(p.readInt32() == NUM_INTS, "int after the object");
+}
+
+static void testSegmentsOff()
+{
+    Parcel p;
+    p.setSegmentSize(SEGMENT_SIZE);
+    writeInts(p, 0, NUM_INTS / 2);
+    expect(p.setSegmentSize(0) == NO_ERROR, "setSegmentSize(0)");
+
+    // Now an ordinary parcel that keeps growing in one piece.
+    writeInts(p, NUM_INTS / 2, NUM_INTS / 2);
+    p.setDataPosition(0);
+    expect(readInts(p, 0, NUM_INTS), "read back after segmenting is off");
+}
+
+int main(int argc, char *argv[])
+{
+    sp<ProcessState> proc(ProcessState::self());
+
+    testReadBack();
+    testData();
+    testAppendFrom();
+    testObject();
+    testSegmentsOff();
+
+    if (failures) {
+        cerr << failures << " failure(s)" << endl;
+        return 1;
+    }
+    cout << "parcelSegments: OK" << endl;
+    return 0;
+}
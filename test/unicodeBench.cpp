@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * UTF-8 <-> UTF-16 transcoding benchmark
+ *
+ * Measures the cost of the conversions behind String8(String16) and
+ * String16(String8) over a few corpora: the service names and interface
+ * descriptors that go over binder all the time, and some longer text in
+ * other scripts.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -n num - convert each corpus num times (default: 100000)
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <utils/Unicode.h>
+
+using namespace android;
+using namespace std;
+
+static const char* const serviceNames[] = {
+    "activity",
+    "package",
+    "window",
+    "media.player",
+    "media.camera",
+    "SurfaceFlinger",
+    "permission",
+    "android.os.IServiceManager",
+    "android.os.IPermissionController",
+    "android.hardware.ICamera",
+    "android.media.IMediaPlayerService",
+    "android.ui.ISurfaceComposer",
+    NULL
+};
+
+static const char* const latinText =
+    "Les na\xc3\xaf""fs \xc3\xa6githales h\xc3\xa2tifs pondant \xc3\xa0 No\xc3\xabl o\xc3\xb9 "
+    "il g\xc3\xa8le sont s\xc3\xbbrs d'\xc3\xaatre d\xc3\xa9\xc3\xa7us en voyant leurs "
+    "dr\xc3\xb4les d'\xc5\x93ufs abim\xc3\xa9s. Zw\xc3\xb6lf gro\xc3\x9f""e Boxk\xc3\xa4mpfer "
+    "jagen Viktor quer \xc3\xbc""ber den Sylter Deich.";
+
+static const char* const cjkText =
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87\xe7\xab\xa0\xe3\x81\xa8"
+    "\xe4\xb8\xad\xe6\x96\x87\xe7\x9a\x84\xe5\x8f\xa5\xe5\xad\x90\xe3\x80\x82 "
+    "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4 \xeb\xac\xb8\xec\x9e\xa5\xeb\x8f\x84 "
+    "\xec\x9e\x88\xec\x8a\xb5\xeb\x8b\x88\xeb\x8b\xa4. "
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87\xe7\xab\xa0\xe3\x81\xa8"
+    "\xe4\xb8\xad\xe6\x96\x87\xe7\x9a\x84\xe5\x8f\xa5\xe5\xad\x90\xe3\x80\x82";
+
+static const char* const emojiText =
+    "status: ok \xf0\x9f\x98\x80 battery \xf0\x9f\x94\x8b 87% network \xf0\x9f\x93\xb6 "
+    "\xf0\x9f\x8e\xb5 now playing \xf0\x9f\x8e\xb5";
+
+struct corpus {
+    const char* name;
+    String8 text;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void runCorpus(const corpus& c, unsigned int iterations)
+{
+    const String16 wide(c.text);
+    const size_t bytes = c.text.bytes();
+    const size_t units = wide.size();
+    char16_t* u16 = new char16_t[units + 1];
+    char* u8 = new char[bytes + 1];
+    size_t check = 0;
+
+    double start = now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        ssize_t len = utf8_to_utf16_length((const uint8_t*) c.text.string(), bytes);
+        utf8_to_utf16((const uint8_t*) c.text.string(), bytes, u16);
+        check += len + u16[0];
+    }
+    double toUtf16 = now() - start;
+
+    start = now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        ssize_t len = utf16_to_utf8_length(wide.string(), units);
+        utf16_to_utf8(wide.string(), units, u8);
+        check += len + u8[0];
+    }
+    double toUtf8 = now() - start;
+
+    start = now();
+    for (unsigned int i = 0; i < iterations; i++) {
+        String8 narrow(wide);
+        String16 widened(narrow);
+        check += widened.size();
+    }
+    double roundTrip = now() - start;
+
+    cout << c.name << " (" << bytes << " bytes, " << units << " units)" << endl;
+    cout << "  utf8 -> utf16: " << toUtf16 / iterations * 1e9 << " ns, "
+         << bytes * (double) iterations / toUtf16 / 1e6 << " MB/s" << endl;
+    cout << "  utf16 -> utf8: " << toUtf8 / iterations * 1e9 << " ns, "
+         << bytes * (double) iterations / toUtf8 / 1e6 << " MB/s" << endl;
+    cout << "  String8/String16 round trip: "
+         << roundTrip / iterations * 1e9 << " ns" << endl;
+
+    if (check == 0) cout << "  (no output)" << endl;
+    delete[] u16;
+    delete[] u8;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int iterations = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:?")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+
+        case '?':
+        default:
+            cerr << "Usage: " << argv[0] << " [-n num]" << endl;
+            exit(1);
+        }
+    }
+
+    String8 names;
+    for (const char* const* name = serviceNames; *name != NULL; name++) {
+        names.append(*name);
+        names.append("\n");
+    }
+    String8 longAscii;
+    for (int i = 0; i < 16; i++) {
+        longAscii.append(names);
+    }
+
+    corpus corpora[] = {
+        { "service name", String8("media.player") },
+        { "interface descriptor", String8("android.os.IServiceManager") },
+        { "service list", names },
+        { "long ascii", longAscii },
+        { "latin", String8(latinText) },
+        { "cjk", String8(cjkText) },
+        { "emoji", String8(emojiText) },
+    };
+
+    cout << "iterations: " << iterations << endl;
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        runCorpus(corpora[i], iterations);
+    }
+
+    return 0;
+}